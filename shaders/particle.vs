@@ -1,14 +1,9 @@
 #version 400 core
 layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aOffset;
-layout (location = 2) in vec3 aColor;
-
-uniform mat4 view;
-uniform mat4 projection;
 
 out vec3 fragColor;
 
 void main() {
-    gl_Position = projection * view * vec4(aPos + aOffset, 1.0);
-    fragColor = aColor;
+    gl_Position = projection * view * vec4(aPos * aRadius + instance_offset(), 1.0);
+    fragColor = shade_color(aShade);
 }
@@ -0,0 +1,42 @@
+// Shared by the particle vertex shaders; Shader inserts it right after their #version line
+layout (location = 1) in vec3 aOffset;
+layout (location = 2) in uvec2 aShade;
+layout (location = 3) in float aRadius;
+layout (location = 4) in uvec4 aQuantized;
+
+layout (std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    // View without the translation, for the space box
+    mat4 rotation;
+    // Width and height in pixels
+    vec4 viewport;
+};
+uniform bool quantized;
+// Low corner and quantization step of each chunk, two texels per chunk
+uniform samplerBuffer chunkBounds;
+layout (std140) uniform Palette {
+    // Core, middle and outer color of each of the MAX_PALETTES palettes
+    vec4 stops[8 * 3];
+};
+
+vec3 shade_color(uvec2 shade) {
+    // Three-stop gradient of the palette shade.x at position shade.y
+    int base = int(shade.x) * 3;
+    float t = float(shade.y) / 255.0;
+    if (t < 0.5) {
+        return mix(stops[base].rgb, stops[base + 1].rgb, t * 2.0);
+    }
+    return mix(stops[base + 1].rgb, stops[base + 2].rgb, (t - 0.5) * 2.0);
+}
+
+vec3 instance_offset() {
+    // Either the float position, or 16-bit fixed point in the bounds of the chunk in aQuantized.w
+    if (!quantized) {
+        return aOffset;
+    }
+    int chunk = int(aQuantized.w);
+    vec3 low = texelFetch(chunkBounds, 2 * chunk).xyz;
+    vec3 quantum = texelFetch(chunkBounds, 2 * chunk + 1).xyz;
+    return low + vec3(aQuantized.xyz) * quantum;
+}
@@ -0,0 +1,32 @@
+#version 400 core
+in vec3 fragColor;
+in vec3 viewPos;
+flat in vec3 sphereCenter;
+flat in float sphereRadius;
+out vec4 FragColor;
+
+layout (std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    // View without the translation, for the space box
+    mat4 rotation;
+    // Width and height in pixels
+    vec4 viewport;
+};
+
+void main() {
+    // Cast the ray from the camera through this fragment against the sphere
+    vec3 dir = normalize(viewPos);
+    float b = dot(dir, sphereCenter);
+    float c = dot(sphereCenter, sphereCenter) - sphereRadius * sphereRadius;
+    float disc = b * b - c;
+    if (disc < 0.0) {
+        discard;
+    }
+    vec3 hit = dir * (b - sqrt(disc));
+
+    // Depth of the sphere surface instead of the quad, so that spheres intersect correctly
+    vec4 clip = projection * vec4(hit, 1.0);
+    gl_FragDepth = 0.5 * (clip.z / clip.w) + 0.5;
+    FragColor = vec4(fragColor, 1.0);
+}
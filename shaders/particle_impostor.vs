@@ -0,0 +1,17 @@
+#version 400 core
+layout (location = 0) in vec2 aCorner;
+
+out vec3 fragColor;
+out vec3 viewPos;
+flat out vec3 sphereCenter;
+flat out float sphereRadius;
+
+void main() {
+    // Camera-facing quad around the sphere, large enough to cover its silhouette when seen off-axis
+    vec4 center = view * vec4(instance_offset(), 1.0);
+    viewPos = center.xyz + vec3(aCorner * aRadius * 1.5, 0.0);
+    gl_Position = projection * vec4(viewPos, 1.0);
+    fragColor = shade_color(aShade);
+    sphereCenter = center.xyz;
+    sphereRadius = aRadius;
+}
@@ -0,0 +1,19 @@
+#version 400 core
+in vec3 fragColor;
+in float splatWeight;
+out vec4 FragColor;
+
+uniform bool gaussian;
+
+void main() {
+    // Accumulates color weighted by density in rgb and the density itself in alpha
+    vec2 d = gl_PointCoord * 2.0 - 1.0;
+    float r2 = dot(d, d);
+    if (r2 > 1.0) {
+        discard;
+    }
+    // exp(-4 r^2) integrates to about a quarter of the disc's area, so scale it back up
+    float kernel = gaussian ? 4.08 * exp(-4.0 * r2) : 1.0;
+    float weight = kernel * splatWeight;
+    FragColor = vec4(fragColor * weight, weight);
+}
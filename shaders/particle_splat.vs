@@ -0,0 +1,16 @@
+#version 400 core
+layout (location = 0) in vec3 aPos;
+
+out vec3 fragColor;
+out float splatWeight;
+
+void main() {
+    // One point sprite per particle covering its projected diameter, from a pixel up to 32 pixels. Each
+    // particle adds about one unit of density in total, however large its sprite is.
+    vec4 center = view * vec4(instance_offset(), 1.0);
+    gl_Position = projection * center;
+    float diameter = aRadius * projection[1][1] * viewport.y / max(-center.z, aRadius);
+    gl_PointSize = clamp(diameter, 1.0, 32.0);
+    splatWeight = 1.0 / (gl_PointSize * gl_PointSize);
+    fragColor = shade_color(aShade);
+}
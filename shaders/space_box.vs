@@ -3,11 +3,17 @@ layout (location = 0) in vec3 aPos;
 
 out vec3 TexCoords;
 
-uniform mat4 view;
-uniform mat4 projection;
+layout (std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    // View without the translation, for the space box
+    mat4 rotation;
+    // Width and height in pixels
+    vec4 viewport;
+};
 
 void main() {
     TexCoords = aPos;
-    vec4 pos = projection * view * vec4(aPos, 1.0);
+    vec4 pos = projection * rotation * vec4(aPos, 1.0);
     gl_Position = pos.xyww;
 }
@@ -0,0 +1,19 @@
+#version 400 core
+out vec4 FragColor;
+
+uniform sampler2D accumulation;
+uniform float exposure;
+uniform float whiteDensity;
+
+void main() {
+    vec4 sum = texelFetch(accumulation, ivec2(gl_FragCoord.xy), 0);
+    if (sum.a <= 0.0) {
+        discard;
+    }
+    // Average color of the splats in this pixel, brightened logarithmically with their density. Writing
+    // the nearest depth keeps the space box from drawing over the cloud.
+    vec3 color = sum.rgb / sum.a;
+    float intensity = clamp(log(1.0 + exposure * sum.a) / log(1.0 + exposure * whiteDensity), 0.0, 1.0);
+    FragColor = vec4(color * intensity, 1.0);
+    gl_FragDepth = 0.0;
+}
@@ -0,0 +1,26 @@
+#include "CameraBuffer.hpp"
+
+
+CameraBuffer::CameraBuffer() {
+    glGenBuffers(1, &this->UBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, this->UBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(CameraUniforms), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_BINDING, this->UBO);
+}
+
+CameraBuffer::~CameraBuffer() {
+    glDeleteBuffers(1, &this->UBO);
+}
+
+void CameraBuffer::update(const glm::mat4 &view, const glm::mat4 &projection, const int viewport_width,
+    const int viewport_height) {
+    CameraUniforms uniforms;
+    uniforms.view = view;
+    uniforms.projection = projection;
+    uniforms.rotation = glm::mat4(glm::mat3(view));
+    uniforms.viewport = glm::vec4(viewport_width, viewport_height, 0.0f, 0.0f);
+    glBindBuffer(GL_UNIFORM_BUFFER, this->UBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(CameraUniforms), &uniforms);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
@@ -0,0 +1,38 @@
+#ifndef CAMERABUFFER_HPP
+#define CAMERABUFFER_HPP
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+// Uniform buffer binding of the Camera block, shared by all programs that declare it
+const unsigned int CAMERA_BINDING = 1;
+
+
+// Layout of the Camera block in std140: matrices are four vec4 columns and vec4 needs no padding
+struct CameraUniforms {
+    glm::mat4 view;
+    glm::mat4 projection;
+    // View without the translation, for the space box
+    glm::mat4 rotation;
+    // Width and height in pixels
+    glm::vec4 viewport;
+};
+
+
+// Camera matrices of the frame in one uniform buffer, written once per frame and read by every shader
+// that declares the Camera block, instead of setting view and projection on each program.
+class CameraBuffer {
+    private:
+        unsigned int UBO;
+
+    public:
+        CameraBuffer();
+        ~CameraBuffer();
+
+        void update(const glm::mat4 &view, const glm::mat4 &projection, const int viewport_width,
+                    const int viewport_height);
+};
+
+#endif
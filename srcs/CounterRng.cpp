@@ -0,0 +1,36 @@
+#include "CounterRng.hpp"
+
+
+CounterRng::CounterRng(const uint64_t seed) {
+    this->key[0] = uint32_t(seed);
+    this->key[1] = uint32_t(seed >> 32);
+}
+
+CounterRng::~CounterRng() {
+}
+
+std::array<uint32_t, 4> CounterRng::generate(const uint32_t c0, const uint32_t c1, const uint32_t c2,
+                                             const uint32_t c3) const {
+    const uint32_t multiplier_0 = 0xD2511F53;
+    const uint32_t multiplier_1 = 0xCD9E8D57;
+    const uint32_t weyl_0 = 0x9E3779B9;
+    const uint32_t weyl_1 = 0xBB67AE85;
+
+    std::array<uint32_t, 4> counter = {c0, c1, c2, c3};
+    uint32_t k0 = this->key[0];
+    uint32_t k1 = this->key[1];
+    for (int round = 0; round < 10; round++) {
+        uint64_t product_0 = uint64_t(multiplier_0) * counter[0];
+        uint64_t product_1 = uint64_t(multiplier_1) * counter[2];
+        counter = {uint32_t(product_1 >> 32) ^ counter[1] ^ k0, uint32_t(product_1),
+                   uint32_t(product_0 >> 32) ^ counter[3] ^ k1, uint32_t(product_0)};
+        k0 += weyl_0;
+        k1 += weyl_1;
+    }
+    return counter;
+}
+
+float CounterRng::to_unit_float(const uint32_t value) {
+    // The top 24 bits fill the float mantissa exactly, giving a uniform value in [0, 1)
+    return (value >> 8) * (1.0f / 16777216.0f);
+}
@@ -0,0 +1,24 @@
+#ifndef COUNTERRNG_HPP
+#define COUNTERRNG_HPP
+
+#include <array>
+#include <cstdint>
+
+
+// Philox4x32-10 counter-based random number generator (Salmon et al., "Parallel Random Numbers: As Easy
+// as 1, 2, 3", SC11). The output is a pure function of the counter and the seed, so each particle can
+// draw its numbers from its own index without any shared state, on any thread and in any order.
+class CounterRng {
+    private:
+        uint32_t key[2];
+
+    public:
+        CounterRng(const uint64_t seed);
+        ~CounterRng();
+
+        std::array<uint32_t, 4> generate(const uint32_t c0, const uint32_t c1, const uint32_t c2,
+                                         const uint32_t c3) const;
+        static float to_unit_float(const uint32_t value);
+};
+
+#endif
@@ -0,0 +1,217 @@
+#include "EventDrivenSolver.hpp"
+
+
+EventDrivenSolver::EventDrivenSolver() {
+    this->truncated = false;
+}
+
+EventDrivenSolver::~EventDrivenSolver() {
+}
+
+void EventDrivenSolver::initialize(const int max_cells_per_axis, const float restitution) {
+    this->max_cells_per_axis = std::max(max_cells_per_axis, 1);
+    this->restitution = restitution;
+}
+
+void EventDrivenSolver::build_grid(const std::vector<glm::vec3> &position, const std::vector<float> &radius,
+    const glm::vec3 &min_bound, const glm::vec3 &max_bound) {
+    float max_radius = 0.0f;
+    for (size_t i = 0; i < position.size(); i++) {
+        max_radius = std::max(max_radius, radius[i]);
+    }
+
+    // The grid spans the bounding box of the particles at the start of the step. Cells must be at least as
+    // large as the largest collision distance so that only the 27 surrounding cells need to be searched.
+    // Particles leaving the grid during the step stay in the clamped boundary cells.
+    glm::vec3 extent = max_bound - min_bound;
+    float max_extent = std::max(extent.x, std::max(extent.y, extent.z));
+    this->cell_size = std::max(2.0f * max_radius, max_extent / this->max_cells_per_axis);
+    this->cell_size = std::max(this->cell_size, 1e-6f);
+    this->grid_min = min_bound;
+    this->grid_dim = glm::clamp(glm::ivec3(glm::ceil(extent / this->cell_size)), 1, this->max_cells_per_axis);
+
+    this->cell_head.assign(this->grid_dim.x * this->grid_dim.y * this->grid_dim.z, -1);
+    this->next_in_cell.assign(position.size(), -1);
+    this->prev_in_cell.assign(position.size(), -1);
+    this->cell_coord.resize(position.size());
+    for (size_t i = 0; i < position.size(); i++) {
+        insert_into_cell(i, cell_coordinate(position[i]));
+    }
+}
+
+int EventDrivenSolver::cell_index(const glm::ivec3 &coord) {
+    return (coord.z * this->grid_dim.y + coord.y) * this->grid_dim.x + coord.x;
+}
+
+glm::ivec3 EventDrivenSolver::cell_coordinate(const glm::vec3 &position) {
+    glm::ivec3 coord(glm::floor((position - this->grid_min) / this->cell_size));
+    return glm::clamp(coord, glm::ivec3(0), this->grid_dim - 1);
+}
+
+void EventDrivenSolver::insert_into_cell(const int i, const glm::ivec3 &coord) {
+    int cell = cell_index(coord);
+    this->cell_coord[i] = coord;
+    this->prev_in_cell[i] = -1;
+    this->next_in_cell[i] = this->cell_head[cell];
+    if (this->cell_head[cell] >= 0) {
+        this->prev_in_cell[this->cell_head[cell]] = i;
+    }
+    this->cell_head[cell] = i;
+}
+
+void EventDrivenSolver::remove_from_cell(const int i) {
+    if (this->prev_in_cell[i] >= 0) {
+        this->next_in_cell[this->prev_in_cell[i]] = this->next_in_cell[i];
+    } else {
+        this->cell_head[cell_index(this->cell_coord[i])] = this->next_in_cell[i];
+    }
+    if (this->next_in_cell[i] >= 0) {
+        this->prev_in_cell[this->next_in_cell[i]] = this->prev_in_cell[i];
+    }
+}
+
+void EventDrivenSolver::synchronize(const int i, std::vector<glm::vec3> &position,
+    const std::vector<glm::vec3> &velocity, const float time) {
+    position[i] += velocity[i] * (time - this->local_time[i]);
+    this->local_time[i] = time;
+}
+
+float EventDrivenSolver::predict_collision(const glm::vec3 &relative_position, const glm::vec3 &relative_velocity,
+    const float collision_distance) {
+    // Only approaching pairs collide; pairs that already overlap collide immediately
+    float b = glm::dot(relative_position, relative_velocity);
+    if (b >= 0.0f) {
+        return -1.0f;
+    }
+    float c = glm::dot(relative_position, relative_position) - collision_distance * collision_distance;
+    if (c <= 0.0f) {
+        return 0.0f;
+    }
+    float a = glm::dot(relative_velocity, relative_velocity);
+    float discriminant = b * b - a * c;
+    if (discriminant < 0.0f) {
+        return -1.0f;
+    }
+    return (-b - std::sqrt(discriminant)) / a;
+}
+
+void EventDrivenSolver::predict_events(const int i, const std::vector<glm::vec3> &position,
+    const std::vector<glm::vec3> &velocity, const std::vector<float> &mass, const std::vector<float> &radius,
+    const float time, const float duration) {
+    // Particle i must be synchronized to time; the partners are extrapolated from their local times.
+    // Tombstones of removed particles have zero mass and never collide.
+    const glm::ivec3 &coord = this->cell_coord[i];
+    glm::ivec3 lower = glm::max(coord - 1, glm::ivec3(0));
+    glm::ivec3 upper = glm::min(coord + 1, this->grid_dim - 1);
+    for (int z = lower.z; z <= upper.z; z++) {
+        for (int y = lower.y; y <= upper.y; y++) {
+            for (int x = lower.x; x <= upper.x; x++) {
+                for (int j = this->cell_head[cell_index(glm::ivec3(x, y, z))]; j >= 0; j = this->next_in_cell[j]) {
+                    if (j == i || mass[j] <= 0.0f) {
+                        continue;
+                    }
+                    glm::vec3 position_j = position[j] + velocity[j] * (time - this->local_time[j]);
+                    float t = predict_collision(position[i] - position_j, velocity[i] - velocity[j],
+                        radius[i] + radius[j]);
+                    if (t >= 0.0f && time + t <= duration) {
+                        this->events.push({time + t, i, j, -1, this->event_count[i], this->event_count[j]});
+                    }
+                }
+            }
+        }
+    }
+
+    // Next cell crossing. Boundary cells extend to infinity, so there is no crossing out of the grid.
+    for (int axis = 0; axis < 3; axis++) {
+        float t = -1.0f;
+        if (velocity[i][axis] > 0.0f && coord[axis] < this->grid_dim[axis] - 1) {
+            float wall = this->grid_min[axis] + (coord[axis] + 1) * this->cell_size;
+            t = (wall - position[i][axis]) / velocity[i][axis];
+        } else if (velocity[i][axis] < 0.0f && coord[axis] > 0) {
+            float wall = this->grid_min[axis] + coord[axis] * this->cell_size;
+            t = (wall - position[i][axis]) / velocity[i][axis];
+        }
+        if (t >= 0.0f && time + t <= duration) {
+            this->events.push({time + t, i, -1, axis, this->event_count[i], 0});
+        }
+    }
+}
+
+bool EventDrivenSolver::is_valid(const Event &event) {
+    if (event.count_i != this->event_count[event.i]) {
+        return false;
+    }
+    return event.j < 0 || event.count_j == this->event_count[event.j];
+}
+
+int EventDrivenSolver::advance(std::vector<glm::vec3> &position, std::vector<glm::vec3> &velocity,
+    const std::vector<float> &mass, const std::vector<float> &radius, const glm::vec3 &min_bound,
+    const glm::vec3 &max_bound, const float duration) {
+    int particle_num = position.size();
+    build_grid(position, radius, min_bound, max_bound);
+    this->local_time.assign(particle_num, 0.0f);
+    this->event_count.assign(particle_num, 0);
+    this->events = std::priority_queue<Event, std::vector<Event>, EventLater>();
+    for (int i = 0; i < particle_num; i++) {
+        if (mass[i] > 0.0f) {
+            predict_events(i, position, velocity, mass, radius, 0.0f, duration);
+        }
+    }
+
+    // Guard against clusters that keep colliding at the same instant. Collisions left in the queue when
+    // the limit is hit are skipped, so get_truncated tells the caller that the step left overlaps behind.
+    long long max_events = 100LL * particle_num + 1000;
+    long long processed = 0;
+    int collision_num = 0;
+    while (!this->events.empty() && processed < max_events) {
+        Event event = this->events.top();
+        this->events.pop();
+        if (!is_valid(event)) {
+            continue;
+        }
+        processed++;
+
+        int i = event.i;
+        synchronize(i, position, velocity, event.time);
+        this->event_count[i]++;
+        if (event.j < 0) {
+            // Cell crossing: the trajectory is unchanged, but the set of candidate partners is not
+            glm::ivec3 coord = this->cell_coord[i];
+            coord[event.axis] += velocity[i][event.axis] > 0.0f ? 1 : -1;
+            remove_from_cell(i);
+            insert_into_cell(i, coord);
+            predict_events(i, position, velocity, mass, radius, event.time, duration);
+        } else {
+            // Collision along the line of centers with the given coefficient of restitution
+            int j = event.j;
+            synchronize(j, position, velocity, event.time);
+            this->event_count[j]++;
+            glm::vec3 diff = position[i] - position[j];
+            float dist_sq = glm::dot(diff, diff);
+            if (dist_sq > 0.0f) {
+                glm::vec3 impulse = (1.0f + this->restitution) / (mass[i] + mass[j])
+                    * glm::dot(velocity[i] - velocity[j], diff) / dist_sq * diff;
+                velocity[i] -= mass[j] * impulse;
+                velocity[j] += mass[i] * impulse;
+            }
+            collision_num++;
+            predict_events(i, position, velocity, mass, radius, event.time, duration);
+            predict_events(j, position, velocity, mass, radius, event.time, duration);
+        }
+    }
+
+    this->truncated = false;
+    while (!this->events.empty() && !this->truncated) {
+        this->truncated = is_valid(this->events.top());
+        this->events.pop();
+    }
+
+    for (int i = 0; i < particle_num; i++) {
+        synchronize(i, position, velocity, duration);
+    }
+    return collision_num;
+}
+
+bool EventDrivenSolver::get_truncated() {
+    return this->truncated;
+}
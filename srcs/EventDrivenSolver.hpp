@@ -0,0 +1,74 @@
+#ifndef EVENTDRIVENSOLVER_HPP
+#define EVENTDRIVENSOLVER_HPP
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <queue>
+#include <vector>
+
+
+struct Event {
+    float time;
+    int i;
+    int j;  // Partner particle, or -1 for a cell crossing
+    int axis;  // Crossed axis of a cell crossing
+    int count_i;
+    int count_j;
+};
+
+struct EventLater {
+    bool operator()(const Event &a, const Event &b) const {
+        return a.time > b.time;
+    }
+};
+
+
+class EventDrivenSolver {
+    private:
+        int max_cells_per_axis;
+        float restitution;
+        float cell_size;
+        glm::vec3 grid_min;
+        glm::ivec3 grid_dim;
+
+        // Particles of each cell as doubly linked lists, so that crossings are O(1)
+        std::vector<int> cell_head;
+        std::vector<int> next_in_cell;
+        std::vector<int> prev_in_cell;
+        std::vector<glm::ivec3> cell_coord;
+
+        // Positions are only brought up to date lazily; local_time is the time they are valid at.
+        // event_count is bumped whenever a trajectory changes, which invalidates queued events.
+        std::vector<float> local_time;
+        std::vector<int> event_count;
+        std::priority_queue<Event, std::vector<Event>, EventLater> events;
+        bool truncated;
+
+        void build_grid(const std::vector<glm::vec3> &position, const std::vector<float> &radius,
+                        const glm::vec3 &min_bound, const glm::vec3 &max_bound);
+        int cell_index(const glm::ivec3 &coord);
+        glm::ivec3 cell_coordinate(const glm::vec3 &position);
+        void insert_into_cell(const int i, const glm::ivec3 &coord);
+        void remove_from_cell(const int i);
+        void synchronize(const int i, std::vector<glm::vec3> &position, const std::vector<glm::vec3> &velocity,
+                        const float time);
+        float predict_collision(const glm::vec3 &relative_position, const glm::vec3 &relative_velocity,
+                                const float collision_distance);
+        void predict_events(const int i, const std::vector<glm::vec3> &position,
+                            const std::vector<glm::vec3> &velocity, const std::vector<float> &mass,
+                            const std::vector<float> &radius, const float time, const float duration);
+        bool is_valid(const Event &event);
+
+    public:
+        EventDrivenSolver();
+        ~EventDrivenSolver();
+
+        void initialize(const int max_cells_per_axis, const float restitution);
+        int advance(std::vector<glm::vec3> &position, std::vector<glm::vec3> &velocity,
+                    const std::vector<float> &mass, const std::vector<float> &radius, const glm::vec3 &min_bound,
+                    const glm::vec3 &max_bound, const float duration);
+        bool get_truncated();
+};
+
+#endif
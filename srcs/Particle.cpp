@@ -3,61 +3,265 @@
 
 Particle::Particle(const glm::vec3 &center_pos_1, const glm::vec3 &center_pos_2, const float planet_radius,
                     const int particle_num_1, const int particle_num_2, const glm::vec3 &initial_velocity_1,
-                    const glm::vec3 &initial_velocity_2, const float mass, const float particle_radius, const int threads) {
-    this->mass = mass;
-    this->collision_distance = particle_radius * 2;
-    this->particle_color.initialize(glm::vec3(1.0f, 1.0f, 0.0f),
-        glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.79f, 0.29f, 0.21f));
-    initialize(center_pos_1, planet_radius, particle_num_1);
-    for (int i = 0; i < particle_num_1; i++) {
-        this->velocity.push_back(initial_velocity_1);
+                    const glm::vec3 &initial_velocity_2, const float mass, const float particle_radius, const int threads,
+                    const SimulationConfig &config) {
+    this->step_num = 0;
+    // std::random_device yields 32 bits per call, so two draws fill the 64-bit Philox key
+    if (config.deterministic) {
+        this->seed = config.seed;
+    } else {
+        std::random_device device;
+        this->seed = (unsigned long long)device() << 32 | device();
     }
-    this->particle_color.initialize(glm::vec3(0.1f, 0.1f, 0.1f),
+    this->planet_num = 0;
+    this->planet_generator.initialize(config);
+    this->coarsening_interval = config.coarsening_interval;
+    this->escape_retire = config.escape_retire;
+    this->tombstone_ratio = config.tombstone_ratio;
+    // Each planet is shaded with the palette of the same index
+    this->particle_color.add_palette(glm::vec3(1.0f, 1.0f, 0.0f),
+        glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.79f, 0.29f, 0.21f));
+    this->particle_color.add_palette(glm::vec3(0.1f, 0.1f, 0.1f),
         glm::vec3(0.3f, 0.6f, 0.8f), glm::vec3(0.12f, 0.38f, 0.93f));
-    initialize(center_pos_2, planet_radius, particle_num_2);
-    for (int i = 0; i < particle_num_2; i++) {
-        this->velocity.push_back(initial_velocity_2);
-    }
-    this->particle_cuda.initialize(this->position, this->velocity, particle_num_1 + particle_num_2,
-                                    threads, this->collision_distance);
+    initialize(center_pos_1, planet_radius, particle_num_1, initial_velocity_1, mass, particle_radius);
+    initialize(center_pos_2, planet_radius, particle_num_2, initial_velocity_2, mass, particle_radius);
+    this->particle_cuda.initialize(this->data, threads, config);
+    this->particle_coarsening.initialize(config);
 }
 
 Particle::~Particle() {
 }
 
-std::vector<glm::vec3> Particle::get_particle_position() {
-    return this->position;
+const std::vector<glm::vec3> &Particle::get_particle_position() {
+    // The simulated particles as they are unless some slots are tombstones or retired particles have to
+    // be appended, so that a frame doesn't copy every particle when nothing was removed
+    if (this->free_slots.empty() && this->retired.position.empty()) {
+        return this->data.position;
+    }
+    this->drawn_position.clear();
+    for (size_t i = 0; i < this->data.position.size(); i++) {
+        if (this->data.mass[i] > 0.0f) {
+            this->drawn_position.push_back(this->data.position[i]);
+        }
+    }
+    this->drawn_position.insert(this->drawn_position.end(), this->retired.position.begin(),
+        this->retired.position.end());
+    return this->drawn_position;
 }
 
-std::vector<glm::vec3> Particle::get_particle_color() {
-    return this->color;
+const std::vector<float> &Particle::get_particle_radius() {
+    if (this->free_slots.empty() && this->retired.radius.empty()) {
+        return this->data.radius;
+    }
+    this->drawn_radius.clear();
+    for (size_t i = 0; i < this->data.radius.size(); i++) {
+        if (this->data.mass[i] > 0.0f) {
+            this->drawn_radius.push_back(this->data.radius[i]);
+        }
+    }
+    this->drawn_radius.insert(this->drawn_radius.end(), this->retired.radius.begin(), this->retired.radius.end());
+    return this->drawn_radius;
 }
 
-void Particle::initialize(
-    const glm::vec3 &center_pos, const float planet_radius, const int particle_num) {
-    std::random_device rd;   // Seed for the random number engine
-    std::mt19937 gen(rd());  // Mersenne Twister engine
+const std::vector<glm::u8vec2> &Particle::get_particle_shade() {
+    if (this->free_slots.empty() && this->retired.shade.empty()) {
+        return this->data.shade;
+    }
+    this->drawn_shade.clear();
+    for (size_t i = 0; i < this->data.shade.size(); i++) {
+        if (this->data.mass[i] > 0.0f) {
+            this->drawn_shade.push_back(this->data.shade[i]);
+        }
+    }
+    this->drawn_shade.insert(this->drawn_shade.end(), this->retired.shade.begin(), this->retired.shade.end());
+    return this->drawn_shade;
+}
 
-    std::uniform_real_distribution<float> angle_phi_dis(-M_PI / 2.0f, M_PI / 2.0f);
-    std::uniform_real_distribution<float> angle_theta_dis(0.0f, 2.0f * M_PI);
-    std::uniform_real_distribution<float> radius_dis(0.0f, planet_radius);
+const std::vector<glm::vec3> &Particle::get_palette_stops() {
+    return this->particle_color.get_stops();
+}
+
+int Particle::add_palette(const glm::vec3 &core_color, const glm::vec3 &middle_color, const glm::vec3 &outer_color) {
+    return this->particle_color.add_palette(core_color, middle_color, outer_color);
+}
+
+int Particle::get_particle_num() {
+    return this->data.position.size() - this->free_slots.size() + this->retired.position.size();
+}
+
+void Particle::get_bounds(glm::vec3 &min_bound, glm::vec3 &max_bound) {
+    // Bounding box of the simulated particles; retired ones fly outside of it
+    this->particle_cuda.get_bounds(min_bound, max_bound);
+}
+
+void Particle::initialize(const glm::vec3 &center_pos, const float planet_radius, const int particle_num,
+    const glm::vec3 &initial_velocity, const float mass, const float particle_radius) {
+    // The random numbers of particle i come from the counter (i, planet), so the planet is the same
+    // for a given seed no matter how the particles are split across threads
+    CounterRng rng(this->seed);
+    uint32_t planet = this->planet_num++;
+    std::vector<glm::vec3> packed;
+    float color_radius = planet_radius;
+    if (this->planet_generator.generate(planet_radius, particle_num, particle_radius, planet, packed)) {
+        // The packing may have grown the planet to avoid overlaps
+        for (const glm::vec3 &offset : packed) {
+            color_radius = std::max(color_radius, glm::length(offset));
+        }
+    }
+    int first = this->data.position.size();
+    this->data.position.resize(first + particle_num);
+    this->data.shade.resize(first + particle_num);
+    this->data.velocity.resize(first + particle_num, initial_velocity);
+    this->data.mass.resize(first + particle_num, mass);
+    this->data.radius.resize(first + particle_num, particle_radius);
     for (int i = 0; i < particle_num; i++) {
-        glm::vec3 pos;
-        float angle_phi = angle_phi_dis(gen);
-        float angle_theta = angle_theta_dis(gen);
-        float radius = radius_dis(gen);
+        this->data.id.push_back(this->data.next_id++);
+    }
 
-        pos.x = center_pos.x + radius * cos(angle_phi) * cos(angle_theta);
-        pos.y = center_pos.y + radius * sin(angle_phi);
-        pos.z = center_pos.z + radius * cos(angle_phi) * sin(angle_theta);
-        this->position.push_back(pos);
+    int thread_num = std::max(1, std::min<int>(std::thread::hardware_concurrency(), particle_num / 1024 + 1));
+    std::vector<std::thread> workers;
+    for (int t = 0; t < thread_num; t++) {
+        int begin = long(particle_num) * t / thread_num;
+        int end = long(particle_num) * (t + 1) / thread_num;
+        workers.push_back(std::thread([&, begin, end]() {
+            for (int i = begin; i < end; i++) {
+                glm::vec3 pos;
+                if (!packed.empty()) {
+                    pos = center_pos + packed[i];
+                } else {
+                    std::array<uint32_t, 4> random = rng.generate(i, planet, 0, 0);
+                    float angle_phi = -M_PI / 2.0f + M_PI * CounterRng::to_unit_float(random[0]);
+                    float angle_theta = 2.0f * M_PI * CounterRng::to_unit_float(random[1]);
+                    float radius = planet_radius * CounterRng::to_unit_float(random[2]);
 
-        glm::vec3 gradient_color;
-        this->particle_color.calculate_gradient_color(center_pos, pos, planet_radius, gradient_color);
-        this->color.push_back(gradient_color);
+                    pos.x = center_pos.x + radius * cos(angle_phi) * cos(angle_theta);
+                    pos.y = center_pos.y + radius * sin(angle_phi);
+                    pos.z = center_pos.z + radius * cos(angle_phi) * sin(angle_theta);
+                }
+                this->data.position[first + i] = pos;
+                this->data.shade[first + i] = this->particle_color.calculate_gradient_shade(planet, center_pos, pos,
+                    color_radius);
+            }
+        }));
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+}
+
+long long Particle::add_particle(const glm::vec3 &position, const glm::vec3 &velocity, const float mass,
+                                 const float radius, const glm::u8vec2 &shade) {
+    // Reuses the slot of a removed particle if there is one, otherwise appends
+    int index;
+    if (!this->free_slots.empty()) {
+        index = this->free_slots.back();
+        this->free_slots.pop_back();
+        this->particle_cuda.write_particle(index, position, velocity, mass, radius);
+    } else {
+        index = this->particle_cuda.insert_particle(position, velocity, mass, radius);
+        this->data.position.push_back(position);
+        this->data.velocity.push_back(velocity);
+        this->data.mass.push_back(mass);
+        this->data.radius.push_back(radius);
+        this->data.shade.push_back(shade);
+        this->data.id.push_back(0);
+    }
+    long long id = this->data.next_id++;
+    this->data.position[index] = position;
+    this->data.velocity[index] = velocity;
+    this->data.mass[index] = mass;
+    this->data.radius[index] = radius;
+    this->data.shade[index] = shade;
+    this->data.id[index] = id;
+    return id;
+}
+
+bool Particle::remove_particle(const long long id) {
+    // Leaves a tombstone with zero mass that no longer interacts; the slot is reused by add_particle
+    // or compacted away once there are too many
+    std::vector<long long>::iterator it = std::find(this->data.id.begin(), this->data.id.end(), id);
+    if (it == this->data.id.end() || this->data.mass[it - this->data.id.begin()] <= 0.0f) {
+        return false;
+    }
+    int index = it - this->data.id.begin();
+    this->particle_cuda.write_particle(index, this->data.position[index], glm::vec3(0.0f), 0.0f, 0.0f);
+    this->particle_coarsening.forget(id);
+    this->data.mass[index] = 0.0f;
+    this->data.radius[index] = 0.0f;
+    this->free_slots.push_back(index);
+    return true;
+}
+
+void Particle::apply_compaction() {
+    // Particles were merged or removed on the device; bring the host-only arrays in line
+    std::vector<int> source_index;
+    std::vector<std::pair<int, int>> merged;
+    std::vector<EscapedParticle> escaped;
+    if (!this->particle_cuda.take_compaction(source_index, merged, escaped)) {
+        return;
+    }
+    for (const std::pair<int, int> &pair : merged) {
+        this->particle_coarsening.forget(this->data.id[pair.first]);
+        this->particle_coarsening.forget(this->data.id[pair.second]);
+    }
+    for (const EscapedParticle &particle : escaped) {
+        int i = particle.index;
+        this->particle_coarsening.forget(this->data.id[i]);
+        if (this->escape_retire && this->data.mass[i] > 0.0f) {
+            this->retired.position.push_back(particle.position);
+            this->retired.velocity.push_back(particle.velocity);
+            this->retired.mass.push_back(this->data.mass[i]);
+            this->retired.radius.push_back(this->data.radius[i]);
+            this->retired.shade.push_back(this->data.shade[i]);
+            this->retired.id.push_back(this->data.id[i]);
+        }
+    }
+
+    ParticleData compacted;
+    for (size_t k = 0; k < source_index.size(); k++) {
+        int i = source_index[k];
+        compacted.velocity.push_back(this->data.velocity[i]);
+        compacted.shade.push_back(this->data.shade[i]);
+        compacted.id.push_back(this->data.id[i]);
+    }
+    compacted.position.swap(this->data.position);
+    compacted.next_id = this->data.next_id;
+    // Merged particles grew, so take mass and radius from the device side
+    this->particle_cuda.get_mass_radius(compacted.mass, compacted.radius);
+    this->data = compacted;
+
+    // Surviving tombstones have moved
+    this->free_slots.clear();
+    for (size_t i = 0; i < this->data.mass.size(); i++) {
+        if (this->data.mass[i] <= 0.0f) {
+            this->free_slots.push_back(i);
+        }
     }
 }
 
 void Particle::update_particle(float delta_time) {
-    this->particle_cuda.update_position_velocity(this->position, this->mass, delta_time);
+    this->step_num++;
+    bool coarsening = this->coarsening_interval > 0 && this->step_num % this->coarsening_interval == 0;
+
+    // Tombstones are compacted away once there are too many of them, and before coarsening so that
+    // it only sees live particles
+    if (!this->free_slots.empty()
+        && (coarsening || this->free_slots.size() > this->tombstone_ratio * this->data.position.size())) {
+        this->particle_cuda.remove_tombstones();
+    }
+    this->particle_cuda.update_position_velocity(this->data.position, delta_time);
+    apply_compaction();
+    for (size_t i = 0; i < this->retired.position.size(); i++) {
+        this->retired.position[i] += this->retired.velocity[i] * delta_time;
+    }
+
+    if (coarsening) {
+        // Merge settled clumps into super-particles and split the disturbed ones again
+        this->particle_cuda.download(this->data, this->impulse);
+        int changed = this->particle_coarsening.split(this->data, this->impulse);
+        changed += this->particle_coarsening.coarsen(this->data, this->impulse);
+        if (changed > 0) {
+            this->particle_cuda.upload(this->data);
+        }
+    }
 }
@@ -4,36 +4,68 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
 #include <vector>
 #include <random>
+#include <thread>
 #include <iostream>
 #include <limits>
 #include <cmath>
 
+#include "CounterRng.hpp"
 #include "ParticleCuda.cuh"
 #include "ParticleColor.hpp"
+#include "ParticleCoarsening.hpp"
+#include "ParticleData.hpp"
+#include "PlanetGenerator.hpp"
+#include "SimulationConfig.hpp"
 
 
 class Particle {
     private:
-        std::vector<glm::vec3> position;
-        std::vector<glm::vec3> velocity;
-        std::vector<glm::vec3> color;
-        float mass;
-        float collision_distance;
+        ParticleData data;
+        // Escaped particles that only fly ballistically on the host
+        ParticleData retired;
+        // Arrays handed out for drawing when tombstones have to be skipped or retired particles appended
+        std::vector<glm::vec3> drawn_position;
+        std::vector<glm::u8vec2> drawn_shade;
+        std::vector<float> drawn_radius;
+        bool escape_retire;
+        // Slots of removed particles that new particles reuse until they are compacted away
+        std::vector<int> free_slots;
+        float tombstone_ratio;
+        std::vector<float> impulse;
+        int step_num;
+        unsigned long long seed;
+        int planet_num;
+        int coarsening_interval;
         ParticleCuda particle_cuda;
         ParticleColor particle_color;
+        ParticleCoarsening particle_coarsening;
+        PlanetGenerator planet_generator;
+
+        void apply_compaction();
 
     public:
         Particle(const glm::vec3 &center_pos_1, const glm::vec3 &center_pos_2, const float planet_radius,
                 const int particle_num_1, const int particle_num_2, const glm::vec3 &initial_velocity_1,
-                const glm::vec3 &initial_velocity_2, const float mass, const float particle_radius, const int threads);
+                const glm::vec3 &initial_velocity_2, const float mass, const float particle_radius, const int threads,
+                const SimulationConfig &config);
         ~Particle();
 
-        std::vector<glm::vec3> get_particle_position();
-        std::vector<glm::vec3> get_particle_color();
+        const std::vector<glm::vec3> &get_particle_position();
+        const std::vector<glm::u8vec2> &get_particle_shade();
+        const std::vector<glm::vec3> &get_palette_stops();
+        int add_palette(const glm::vec3 &core_color, const glm::vec3 &middle_color, const glm::vec3 &outer_color);
+        const std::vector<float> &get_particle_radius();
+        int get_particle_num();
+        void get_bounds(glm::vec3 &min_bound, glm::vec3 &max_bound);
 
-        void initialize(const glm::vec3 &center_pos, const float planet_radius, const int particle_num);
+        void initialize(const glm::vec3 &center_pos, const float planet_radius, const int particle_num,
+                        const glm::vec3 &initial_velocity, const float mass, const float particle_radius);
+        long long add_particle(const glm::vec3 &position, const glm::vec3 &velocity, const float mass,
+                               const float radius, const glm::u8vec2 &shade);
+        bool remove_particle(const long long id);
         void update_particle(const float delta_time);
 };
 
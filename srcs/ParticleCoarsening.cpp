@@ -0,0 +1,185 @@
+#include "ParticleCoarsening.hpp"
+
+
+ParticleCoarsening::ParticleCoarsening() {
+}
+
+ParticleCoarsening::~ParticleCoarsening() {
+}
+
+void ParticleCoarsening::initialize(const SimulationConfig &config) {
+    this->cell_size = config.coarsening_cell_size;
+    this->min_members = std::max(config.coarsening_min_members, 2);
+    this->max_dispersion = config.coarsening_max_dispersion;
+    this->split_impulse = config.coarsening_split_impulse;
+    this->require_bound = config.coarsening_require_bound;
+}
+
+bool ParticleCoarsening::is_settled(const ParticleData &data, const std::vector<int> &group) {
+    float total_mass = 0.0f;
+    glm::vec3 center_of_mass(0.0f);
+    glm::vec3 momentum(0.0f);
+    for (int i : group) {
+        total_mass += data.mass[i];
+        center_of_mass += data.mass[i] * data.position[i];
+        momentum += data.mass[i] * data.velocity[i];
+    }
+    center_of_mass /= total_mass;
+    glm::vec3 group_velocity = momentum / total_mass;
+
+    // Mass-weighted velocity dispersion and extent around the center of mass
+    float kinetic_energy = 0.0f;
+    float group_radius = 0.0f;
+    for (int i : group) {
+        glm::vec3 relative_velocity = data.velocity[i] - group_velocity;
+        kinetic_energy += 0.5f * data.mass[i] * glm::dot(relative_velocity, relative_velocity);
+        group_radius = std::max(group_radius, glm::distance(data.position[i], center_of_mass) + data.radius[i]);
+    }
+    float dispersion = std::sqrt(2.0f * kinetic_energy / total_mass);
+    if (dispersion > this->max_dispersion) {
+        return false;
+    }
+
+    // Bound if the internal kinetic energy is below the binding energy of a uniform sphere
+    if (this->require_bound) {
+        float binding_energy = 0.6f * GRAVITATIONAL_CONSTANT * total_mass * total_mass / group_radius;
+        if (kinetic_energy >= binding_energy) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void ParticleCoarsening::remove_particles(ParticleData &data, std::vector<float> &impulse,
+    const std::vector<bool> &removed) {
+    int k = 0;
+    for (size_t i = 0; i < data.position.size(); i++) {
+        if (removed[i]) {
+            continue;
+        }
+        data.position[k] = data.position[i];
+        data.velocity[k] = data.velocity[i];
+        data.mass[k] = data.mass[i];
+        data.radius[k] = data.radius[i];
+        data.shade[k] = data.shade[i];
+        data.id[k] = data.id[i];
+        impulse[k] = impulse[i];
+        k++;
+    }
+    data.position.resize(k);
+    data.velocity.resize(k);
+    data.mass.resize(k);
+    data.radius.resize(k);
+    data.shade.resize(k);
+    data.id.resize(k);
+    impulse.resize(k);
+}
+
+int ParticleCoarsening::split(ParticleData &data, std::vector<float> &impulse) {
+    // Super-particles that took a strong contact impulse are replaced by their members again.
+    // The members get the current motion of the super-particle plus their stored internal motion,
+    // which keeps mass and momentum unchanged.
+    int particle_num = data.position.size();
+    std::vector<bool> removed(particle_num, false);
+    int split_num = 0;
+    for (int i = 0; i < particle_num; i++) {
+        if (impulse[i] <= this->split_impulse) {
+            continue;
+        }
+        auto it = this->members.find(data.id[i]);
+        if (it == this->members.end()) {
+            continue;
+        }
+        for (const CoarseMember &member : it->second) {
+            data.position.push_back(data.position[i] + member.relative_position);
+            data.velocity.push_back(data.velocity[i] + member.relative_velocity);
+            data.mass.push_back(member.mass);
+            data.radius.push_back(member.radius);
+            data.shade.push_back(member.shade);
+            data.id.push_back(member.id);
+            // The members count as disturbed so that they are not merged again right away
+            impulse.push_back(std::numeric_limits<float>::max());
+            removed.push_back(false);
+        }
+        this->members.erase(it);
+        removed[i] = true;
+        split_num++;
+    }
+
+    if (split_num > 0) {
+        remove_particles(data, impulse, removed);
+    }
+    return split_num;
+}
+
+int ParticleCoarsening::coarsen(ParticleData &data, std::vector<float> &impulse) {
+    // Bin the undisturbed particles into a uniform grid; each occupied cell is a candidate group
+    int particle_num = data.position.size();
+    std::unordered_map<long long, std::vector<int>> cells;
+    const long long axis_cells = 1 << 20;
+    for (int i = 0; i < particle_num; i++) {
+        if (impulse[i] > this->split_impulse) {
+            continue;
+        }
+        glm::ivec3 coord(glm::floor(data.position[i] / this->cell_size));
+        long long key = ((coord.x + axis_cells / 2) * axis_cells + (coord.y + axis_cells / 2)) * axis_cells
+            + (coord.z + axis_cells / 2);
+        cells[key].push_back(i);
+    }
+
+    std::vector<bool> removed(particle_num, false);
+    int coarsened_num = 0;
+    for (auto &cell : cells) {
+        std::vector<int> &group = cell.second;
+        if (int(group.size()) < this->min_members || !is_settled(data, group)) {
+            continue;
+        }
+
+        float total_mass = 0.0f;
+        float total_volume = 0.0f;
+        glm::vec3 center_of_mass(0.0f);
+        glm::vec3 momentum(0.0f);
+        float gradient = 0.0f;
+        for (int i : group) {
+            total_mass += data.mass[i];
+            total_volume += data.radius[i] * data.radius[i] * data.radius[i];
+            center_of_mass += data.mass[i] * data.position[i];
+            momentum += data.mass[i] * data.velocity[i];
+            gradient += data.mass[i] * data.shade[i].y;
+        }
+        center_of_mass /= total_mass;
+        glm::vec3 group_velocity = momentum / total_mass;
+
+        long long super_id = data.next_id++;
+        std::vector<CoarseMember> &super_members = this->members[super_id];
+        for (int i : group) {
+            super_members.push_back({data.position[i] - center_of_mass, data.velocity[i] - group_velocity,
+                data.mass[i], data.radius[i], data.shade[i], data.id[i]});
+            removed[i] = true;
+        }
+
+        // The super-particle keeps the total volume of its members, but no more than fits into its cell.
+        // Otherwise super-particles of neighboring cells overlap, split on the contact impulse and are
+        // merged again on the next pass.
+        data.position.push_back(center_of_mass);
+        data.velocity.push_back(group_velocity);
+        data.mass.push_back(total_mass);
+        data.radius.push_back(std::min(std::cbrt(total_volume), 0.5f * this->cell_size));
+        // Clumps form within one planet, so the palette of any member will do
+        data.shade.push_back(glm::u8vec2(data.shade[group[0]].x, std::lround(gradient / total_mass)));
+        data.id.push_back(super_id);
+        impulse.push_back(0.0f);
+        removed.push_back(false);
+        coarsened_num += group.size() - 1;
+    }
+
+    if (coarsened_num > 0) {
+        remove_particles(data, impulse, removed);
+    }
+    return coarsened_num;
+}
+
+void ParticleCoarsening::forget(const long long id) {
+    // The particle was merged with another one for good, so its members can't be restored anymore
+    this->members.erase(id);
+}
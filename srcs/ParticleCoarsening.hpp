@@ -0,0 +1,48 @@
+#ifndef PARTICLECOARSENING_HPP
+#define PARTICLECOARSENING_HPP
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+#include "ParticleData.hpp"
+#include "SimulationConfig.hpp"
+
+
+struct CoarseMember {
+    glm::vec3 relative_position;
+    glm::vec3 relative_velocity;
+    float mass;
+    float radius;
+    glm::u8vec2 shade;
+    long long id;
+};
+
+
+class ParticleCoarsening {
+    private:
+        float cell_size;
+        int min_members;
+        float max_dispersion;
+        float split_impulse;
+        bool require_bound;
+        // Members of every super-particle relative to its center of mass, by super-particle id
+        std::unordered_map<long long, std::vector<CoarseMember>> members;
+
+        bool is_settled(const ParticleData &data, const std::vector<int> &group);
+        void remove_particles(ParticleData &data, std::vector<float> &impulse, const std::vector<bool> &removed);
+
+    public:
+        ParticleCoarsening();
+        ~ParticleCoarsening();
+
+        void initialize(const SimulationConfig &config);
+        int split(ParticleData &data, std::vector<float> &impulse);
+        int coarsen(ParticleData &data, std::vector<float> &impulse);
+        void forget(const long long id);
+};
+
+#endif
@@ -4,22 +4,34 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/type_precision.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
 
+// Must match the palette block of the particle shaders
+#define MAX_PALETTES 8
+#define PALETTE_STOPS 3
 
+
+// Palettes of three color stops (core, middle, outer). Particles only carry a palette index and their
+// position along its gradient; the shaders look up the color, so editing a palette recolors all of its
+// particles at once.
 class ParticleColor {
     private:
-        glm::vec3 core_color;
-        glm::vec3 middle_color;
-        glm::vec3 outer_color;
+        std::vector<glm::vec3> stops;
 
     public:
         ParticleColor();
         ~ParticleColor();
 
-        void initialize(const glm::vec3 &core_color, const glm::vec3 &middle_color, const glm::vec3 &outer_color);
-        glm::vec3 mix_color(const glm::vec3 &c1, const glm::vec3 &c2, const float ratio);
-        void calculate_gradient_color(const glm::vec3 &center_pos, const glm::vec3 &particle_pos,
-                                        const float radius, glm::vec3 &gradient_color);
+        int add_palette(const glm::vec3 &core_color, const glm::vec3 &middle_color, const glm::vec3 &outer_color);
+        void set_palette(const int palette, const glm::vec3 &core_color, const glm::vec3 &middle_color,
+                         const glm::vec3 &outer_color);
+        const std::vector<glm::vec3> &get_stops();
+        glm::u8vec2 calculate_gradient_shade(const int palette, const glm::vec3 &center_pos,
+                                             const glm::vec3 &particle_pos, const float radius);
 };
 
 #endif
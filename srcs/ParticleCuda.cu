@@ -1,43 +1,799 @@
 #include "ParticleCuda.cuh"
 
+#include <thrust/execution_policy.h>
+#include <thrust/functional.h>
+#include <thrust/reduce.h>
+#include <thrust/scan.h>
+#include <thrust/transform_reduce.h>
 
-ParticleCuda::ParticleCuda() {}
+
+struct Vec3Min {
+    __host__ __device__ glm::vec3 operator()(const glm::vec3 &a, const glm::vec3 &b) const {
+        return glm::min(a, b);
+    }
+};
+
+struct Vec3Max {
+    __host__ __device__ glm::vec3 operator()(const glm::vec3 &a, const glm::vec3 &b) const {
+        return glm::max(a, b);
+    }
+};
+
+struct SquaredLength {
+    __host__ __device__ float operator()(const glm::vec3 &v) const {
+        return glm::dot(v, v);
+    }
+};
+
+ParticleCuda::ParticleCuda() {
+    this->cu_position = nullptr;
+    this->cu_velocity = nullptr;
+    this->cu_velocity_next = nullptr;
+    this->cu_acceleration = nullptr;
+    this->cu_mass = nullptr;
+    this->cu_radius = nullptr;
+    this->cu_impulse = nullptr;
+    this->particle_num = 0;
+    this->particle_capacity = 0;
+    this->acceleration_valid = false;
+    this->cu_reference_position = nullptr;
+    this->cu_displacement = nullptr;
+    this->cu_neighbor_count = nullptr;
+    this->cu_neighbor_offset = nullptr;
+    this->cu_neighbor_index = nullptr;
+    this->neighbor_capacity = 0;
+    this->neighbor_list_skin = 0.0f;
+    this->max_sweep = 0.0f;
+    this->neighbor_list_valid = false;
+    this->cu_contact_count = nullptr;
+    this->cu_contact_offset = nullptr;
+    this->cu_contact_index = nullptr;
+    this->cu_contact_time = nullptr;
+    this->contact_capacity = 0;
+    this->cu_impact_time = nullptr;
+    this->contact_num = 0;
+    this->cu_merge_partner = nullptr;
+    this->cu_keep = nullptr;
+    this->cu_new_index = nullptr;
+    this->cu_source_index = nullptr;
+    this->event_driven_active = false;
+    this->event_driven_truncations = 0;
+    this->cu_previous_acceleration = nullptr;
+    this->cu_contact_seen = nullptr;
+    this->cu_sleep_counter = nullptr;
+    this->cu_asleep = nullptr;
+    this->step_num = 0;
+    this->bounds_min = glm::vec3(0.0f);
+    this->bounds_max = glm::vec3(0.0f);
+}
 
 ParticleCuda::~ParticleCuda() {
+    free_particle_buffers();
+    cudaFree(this->cu_neighbor_index);
+    cudaFree(this->cu_contact_index);
+    cudaFree(this->cu_contact_time);
+    this->cu_neighbor_index = nullptr;
+    this->cu_contact_index = nullptr;
+    this->cu_contact_time = nullptr;
+}
+
+void ParticleCuda::initialize(const ParticleData &data, const int threads, const SimulationConfig &config) {
+    this->threads = threads;
+    this->respa_inner_steps = std::max(config.respa_inner_steps, 1);
+    this->neighbor_skin = config.neighbor_skin;
+    this->max_sweep = 0.0f;
+    this->continuous_collision = config.continuous_collision;
+    this->restitution = config.restitution;
+    this->accretion_speed = config.accretion_speed;
+    this->event_driven = config.event_driven;
+    this->event_driven_contact_ratio = config.event_driven_contact_ratio;
+    this->event_driven_active = config.event_driven;
+    this->event_solver.initialize(config.event_driven_max_cells, config.restitution);
+    this->sleep_steps = config.sleep_steps;
+    this->sleep_speed = config.sleep_speed;
+    this->sleep_acceleration = config.sleep_acceleration;
+    this->sleep_check_interval = std::max(config.sleep_check_interval, 1);
+    this->escape_check_interval = config.escape_check_interval;
+    this->escape_distance = config.escape_distance;
+    this->deterministic = config.deterministic;
+
+    upload(data);
+}
+
+void ParticleCuda::allocate_particle_buffers(const int capacity) {
+    // Buffers with one entry per particle; the CSR offsets need one more
+    cudaMalloc(&this->cu_position, capacity * sizeof(glm::vec3));
+    cudaMalloc(&this->cu_velocity, capacity * sizeof(glm::vec3));
+    cudaMalloc(&this->cu_velocity_next, capacity * sizeof(glm::vec3));
+    cudaMalloc(&this->cu_acceleration, capacity * sizeof(glm::vec3));
+    cudaMalloc(&this->cu_mass, capacity * sizeof(float));
+    cudaMalloc(&this->cu_radius, capacity * sizeof(float));
+    cudaMalloc(&this->cu_impulse, capacity * sizeof(float));
+    cudaMalloc(&this->cu_reference_position, capacity * sizeof(glm::vec3));
+    cudaMalloc(&this->cu_displacement, capacity * sizeof(float));
+    cudaMalloc(&this->cu_neighbor_count, capacity * sizeof(int));
+    cudaMalloc(&this->cu_neighbor_offset, (capacity + 1) * sizeof(int));
+    cudaMalloc(&this->cu_contact_count, capacity * sizeof(int));
+    cudaMalloc(&this->cu_contact_offset, (capacity + 1) * sizeof(int));
+    cudaMalloc(&this->cu_impact_time, capacity * sizeof(float));
+    cudaMalloc(&this->cu_merge_partner, capacity * sizeof(int));
+    cudaMalloc(&this->cu_keep, capacity * sizeof(int));
+    cudaMalloc(&this->cu_new_index, (capacity + 1) * sizeof(int));
+    cudaMalloc(&this->cu_source_index, capacity * sizeof(int));
+    cudaMalloc(&this->cu_previous_acceleration, capacity * sizeof(glm::vec3));
+    cudaMalloc(&this->cu_contact_seen, capacity * sizeof(int));
+    cudaMalloc(&this->cu_sleep_counter, capacity * sizeof(int));
+    cudaMalloc(&this->cu_asleep, capacity * sizeof(int));
+    this->particle_capacity = capacity;
+}
+
+void ParticleCuda::free_particle_buffers() {
     cudaFree(this->cu_position);
     cudaFree(this->cu_velocity);
+    cudaFree(this->cu_velocity_next);
+    cudaFree(this->cu_acceleration);
+    cudaFree(this->cu_mass);
+    cudaFree(this->cu_radius);
+    cudaFree(this->cu_impulse);
+    cudaFree(this->cu_reference_position);
+    cudaFree(this->cu_displacement);
+    cudaFree(this->cu_neighbor_count);
+    cudaFree(this->cu_neighbor_offset);
+    cudaFree(this->cu_contact_count);
+    cudaFree(this->cu_contact_offset);
+    cudaFree(this->cu_impact_time);
+    cudaFree(this->cu_merge_partner);
+    cudaFree(this->cu_keep);
+    cudaFree(this->cu_new_index);
+    cudaFree(this->cu_source_index);
+    cudaFree(this->cu_previous_acceleration);
+    cudaFree(this->cu_contact_seen);
+    cudaFree(this->cu_sleep_counter);
+    cudaFree(this->cu_asleep);
+    this->cu_position = nullptr;
+    this->cu_velocity = nullptr;
+    this->cu_velocity_next = nullptr;
+    this->cu_acceleration = nullptr;
+    this->cu_mass = nullptr;
+    this->cu_radius = nullptr;
+    this->cu_impulse = nullptr;
+    this->cu_reference_position = nullptr;
+    this->cu_displacement = nullptr;
+    this->cu_neighbor_count = nullptr;
+    this->cu_neighbor_offset = nullptr;
+    this->cu_contact_count = nullptr;
+    this->cu_contact_offset = nullptr;
+    this->cu_impact_time = nullptr;
+    this->cu_merge_partner = nullptr;
+    this->cu_keep = nullptr;
+    this->cu_new_index = nullptr;
+    this->cu_source_index = nullptr;
+    this->cu_previous_acceleration = nullptr;
+    this->cu_contact_seen = nullptr;
+    this->cu_sleep_counter = nullptr;
+    this->cu_asleep = nullptr;
+    this->particle_capacity = 0;
 }
 
-void ParticleCuda::initialize(const std::vector<glm::vec3> &position, const std::vector<glm::vec3> &velocity,
-    const int particle_num, const int threads, const float collision_distance) {
-    this->threads = threads;
-    this->blocks = (particle_num + threads - 1) / threads;
-    this->collision_distance = collision_distance;
+void ParticleCuda::reallocate_particle_buffers(const int capacity) {
+    // Moves the state that lives across steps into buffers of the new capacity. Everything else is
+    // scratch or rebuilt from it.
+    glm::vec3 *position = this->cu_position;
+    glm::vec3 *velocity = this->cu_velocity;
+    glm::vec3 *acceleration = this->cu_acceleration;
+    float *mass = this->cu_mass;
+    float *radius = this->cu_radius;
+    float *impulse = this->cu_impulse;
+    int *sleep_counter = this->cu_sleep_counter;
+    int *asleep = this->cu_asleep;
+    this->cu_position = nullptr;
+    this->cu_velocity = nullptr;
+    this->cu_acceleration = nullptr;
+    this->cu_mass = nullptr;
+    this->cu_radius = nullptr;
+    this->cu_impulse = nullptr;
+    this->cu_sleep_counter = nullptr;
+    this->cu_asleep = nullptr;
+    free_particle_buffers();
+    allocate_particle_buffers(capacity);
 
-    // Allocate device memory
-    cudaMalloc(&this->cu_position, particle_num * sizeof(glm::vec3));
-    cudaMalloc(&this->cu_velocity, particle_num * sizeof(glm::vec3));
+    int n = this->particle_num;
+    cudaMemcpy(this->cu_position, position, n * sizeof(glm::vec3), cudaMemcpyDeviceToDevice);
+    cudaMemcpy(this->cu_velocity, velocity, n * sizeof(glm::vec3), cudaMemcpyDeviceToDevice);
+    cudaMemcpy(this->cu_acceleration, acceleration, n * sizeof(glm::vec3), cudaMemcpyDeviceToDevice);
+    cudaMemcpy(this->cu_mass, mass, n * sizeof(float), cudaMemcpyDeviceToDevice);
+    cudaMemcpy(this->cu_radius, radius, n * sizeof(float), cudaMemcpyDeviceToDevice);
+    cudaMemcpy(this->cu_impulse, impulse, n * sizeof(float), cudaMemcpyDeviceToDevice);
+    cudaMemcpy(this->cu_sleep_counter, sleep_counter, n * sizeof(int), cudaMemcpyDeviceToDevice);
+    cudaMemcpy(this->cu_asleep, asleep, n * sizeof(int), cudaMemcpyDeviceToDevice);
+    cudaFree(position);
+    cudaFree(velocity);
+    cudaFree(acceleration);
+    cudaFree(mass);
+    cudaFree(radius);
+    cudaFree(impulse);
+    cudaFree(sleep_counter);
+    cudaFree(asleep);
+    this->neighbor_list_valid = false;
+}
 
-    cudaMemcpy(this->cu_position, position.data(), particle_num * sizeof(glm::vec3),
+void ParticleCuda::upload(const ParticleData &data) {
+    // Replaces the whole particle set, e.g. after particles were merged or split on the host
+    int particle_num = data.position.size();
+    if (particle_num > this->particle_capacity) {
+        free_particle_buffers();
+        allocate_particle_buffers(grow_capacity(this->particle_capacity, particle_num));
+    }
+    this->particle_num = particle_num;
+    this->blocks = (particle_num + this->threads - 1) / this->threads;
+
+    cudaMemcpy(this->cu_position, data.position.data(), particle_num * sizeof(glm::vec3),
                cudaMemcpyHostToDevice);
-    cudaMemcpy(this->cu_velocity, velocity.data(), particle_num * sizeof(glm::vec3),
+    cudaMemcpy(this->cu_velocity, data.velocity.data(), particle_num * sizeof(glm::vec3),
                cudaMemcpyHostToDevice);
+    cudaMemcpy(this->cu_mass, data.mass.data(), particle_num * sizeof(float), cudaMemcpyHostToDevice);
+    cudaMemcpy(this->cu_radius, data.radius.data(), particle_num * sizeof(float), cudaMemcpyHostToDevice);
+    cudaMemset(this->cu_impulse, 0, particle_num * sizeof(float));
+    cudaMemset(this->cu_contact_seen, 0, particle_num * sizeof(int));
+    reset_sleep();
+    this->host_mass = data.mass;
+    this->host_radius = data.radius;
+    this->host_velocity.resize(particle_num);
+    this->host_source_index.clear();
+    this->host_merged.clear();
+    this->host_escaped.clear();
+
+    this->acceleration_valid = false;
+    build_neighbor_list();
+    compute_bounds();
 }
 
-void ParticleCuda::update_position_velocity(std::vector<glm::vec3> &position,
-    const float mass, const float delta_time) {
-    update_particle_kernel<<<this->blocks, this->threads>>>(
-        this->cu_position, this->cu_velocity, mass, delta_time,
-        position.size(), this->collision_distance);
+void ParticleCuda::download(ParticleData &data, std::vector<float> &impulse) {
+    // Copies the dynamic state back and hands over the contact impulses accumulated since the last call
+    cudaDeviceSynchronize();
+    data.position.resize(this->particle_num);
+    data.velocity.resize(this->particle_num);
+    data.mass.resize(this->particle_num);
+    data.radius.resize(this->particle_num);
+    impulse.resize(this->particle_num);
+    cudaMemcpy(data.position.data(), this->cu_position, this->particle_num * sizeof(glm::vec3),
+               cudaMemcpyDeviceToHost);
+    cudaMemcpy(data.velocity.data(), this->cu_velocity, this->particle_num * sizeof(glm::vec3),
+               cudaMemcpyDeviceToHost);
+    cudaMemcpy(data.mass.data(), this->cu_mass, this->particle_num * sizeof(float), cudaMemcpyDeviceToHost);
+    cudaMemcpy(data.radius.data(), this->cu_radius, this->particle_num * sizeof(float), cudaMemcpyDeviceToHost);
+    cudaMemcpy(impulse.data(), this->cu_impulse, this->particle_num * sizeof(float), cudaMemcpyDeviceToHost);
+    cudaMemset(this->cu_impulse, 0, this->particle_num * sizeof(float));
+}
 
+void ParticleCuda::download_acceleration(std::vector<glm::vec3> &acceleration) {
+    // Gravity as last used by the integrator, i.e. stale for sleeping particles
+    if (!this->acceleration_valid) {
+        compute_gravity(true);
+    }
+    cudaDeviceSynchronize();
+    acceleration.resize(this->particle_num);
+    cudaMemcpy(acceleration.data(), this->cu_acceleration, this->particle_num * sizeof(glm::vec3),
+               cudaMemcpyDeviceToHost);
+}
+
+void ParticleCuda::check_kernel_error() {
     cudaError_t err = cudaGetLastError();
     if (err != cudaSuccess) {
         std::cerr << "CUDA error: " << cudaGetErrorString(err) << std::endl;
         ParticleCuda::~ParticleCuda();
         exit(1);
     }
+}
+
+void ParticleCuda::compute_gravity(const bool include_asleep) {
+    compute_gravity_kernel<<<this->blocks, this->threads>>>(
+        this->cu_position, this->cu_mass, this->cu_radius, this->cu_acceleration, this->cu_asleep,
+        include_asleep, this->particle_num);
+    check_kernel_error();
+    this->acceleration_valid = true;
+}
+
+void ParticleCuda::reset_sleep() {
+    cudaMemset(this->cu_sleep_counter, 0, this->particle_num * sizeof(int));
+    cudaMemset(this->cu_asleep, 0, this->particle_num * sizeof(int));
+}
+
+void ParticleCuda::kick(const float delta_time) {
+    kick_kernel<<<this->blocks, this->threads>>>(
+        this->cu_velocity, this->cu_acceleration, delta_time, this->particle_num);
+    check_kernel_error();
+}
+
+void ParticleCuda::compute_bounds() {
+    // Tight axis-aligned box around all particles, for sizing spatial structures to the data
+    if (this->particle_num == 0) {
+        this->bounds_min = glm::vec3(0.0f);
+        this->bounds_max = glm::vec3(0.0f);
+        return;
+    }
+    this->bounds_min = thrust::reduce(thrust::device, this->cu_position, this->cu_position + this->particle_num,
+        glm::vec3(std::numeric_limits<float>::max()), Vec3Min());
+    this->bounds_max = thrust::reduce(thrust::device, this->cu_position, this->cu_position + this->particle_num,
+        glm::vec3(std::numeric_limits<float>::lowest()), Vec3Max());
+}
+
+void ParticleCuda::get_bounds(glm::vec3 &min_bound, glm::vec3 &max_bound) {
+    min_bound = this->bounds_min;
+    max_bound = this->bounds_max;
+}
+
+void ParticleCuda::get_mass_radius(std::vector<float> &mass, std::vector<float> &radius) {
+    // Host mirrors, which are kept up to date through merges and compactions without a transfer
+    mass = this->host_mass;
+    radius = this->host_radius;
+}
+
+int ParticleCuda::get_event_driven_truncations() {
+    // Number of event-driven steps that hit the event limit and fell back to time stepping
+    return this->event_driven_truncations;
+}
+
+int ParticleCuda::scan_offsets(const int *cu_count, int *cu_offset) {
+    // Exclusive scan of the counts; the total is stored after the last offset so that
+    // the slice of particle i is always [offset[i], offset[i + 1])
+    thrust::exclusive_scan(thrust::device, cu_count, cu_count + this->particle_num, cu_offset);
+
+    int last_offset = 0;
+    int last_count = 0;
+    if (this->particle_num > 0) {
+        cudaMemcpy(&last_offset, cu_offset + this->particle_num - 1, sizeof(int), cudaMemcpyDeviceToHost);
+        cudaMemcpy(&last_count, cu_count + this->particle_num - 1, sizeof(int), cudaMemcpyDeviceToHost);
+    }
+    int total = last_offset + last_count;
+    cudaMemcpy(cu_offset + this->particle_num, &total, sizeof(int), cudaMemcpyHostToDevice);
+    return total;
+}
+
+glm::vec3 ParticleCuda::sum(glm::vec3 *cu_value) {
+    // Sum over one value per particle, overwriting the buffer. In deterministic mode it is a pairwise
+    // tree whose shape depends only on the particle count, so the rounding is the same on every run
+    // and for any number of threads.
+    if (!this->deterministic) {
+        return thrust::reduce(thrust::device, cu_value, cu_value + this->particle_num, glm::vec3(0.0f),
+            thrust::plus<glm::vec3>());
+    }
+    for (int n = this->particle_num; n > 1; n = (n + 1) / 2) {
+        pairwise_sum_kernel<<<this->blocks, this->threads>>>(cu_value, n, (n + 1) / 2);
+    }
+    check_kernel_error();
+    glm::vec3 total(0.0f);
+    if (this->particle_num > 0) {
+        cudaMemcpy(&total, cu_value, sizeof(glm::vec3), cudaMemcpyDeviceToHost);
+    }
+    return total;
+}
+
+float ParticleCuda::sum(float *cu_value) {
+    if (!this->deterministic) {
+        return thrust::reduce(thrust::device, cu_value, cu_value + this->particle_num, 0.0f);
+    }
+    for (int n = this->particle_num; n > 1; n = (n + 1) / 2) {
+        pairwise_sum_kernel<<<this->blocks, this->threads>>>(cu_value, n, (n + 1) / 2);
+    }
+    check_kernel_error();
+    float total = 0.0f;
+    if (this->particle_num > 0) {
+        cudaMemcpy(&total, cu_value, sizeof(float), cudaMemcpyDeviceToHost);
+    }
+    return total;
+}
+
+int ParticleCuda::grow_capacity(const int capacity, const int required) {
+    if (required <= capacity) {
+        return capacity;
+    }
+    // Double the capacity so that growing one particle at a time costs amortized constant time
+    return std::max(required, 2 * capacity);
+}
+
+void ParticleCuda::build_neighbor_list() {
+    // The skin grows with the longest sweep of the coming step, so that every pair that can touch during
+    // the sweep is in the list even when particles move further than the configured skin in one step.
+    // Half of neighbor_skin is left for the drift until the next rebuild.
+    this->neighbor_list_skin = this->neighbor_skin + 2.0f * this->max_sweep;
+
+    // First pass counts the neighbors within radius_i + radius_j + skin so that the CSR offsets
+    // can be computed with a scan
+    count_neighbors_kernel<<<this->blocks, this->threads>>>(
+        this->cu_position, this->cu_mass, this->cu_radius, this->cu_neighbor_count, this->particle_num,
+        this->neighbor_list_skin);
+    check_kernel_error();
+    int total = scan_offsets(this->cu_neighbor_count, this->cu_neighbor_offset);
+    int capacity = grow_capacity(this->neighbor_capacity, total);
+    if (capacity != this->neighbor_capacity) {
+        cudaFree(this->cu_neighbor_index);
+        cudaMalloc(&this->cu_neighbor_index, capacity * sizeof(int));
+        this->neighbor_capacity = capacity;
+    }
+
+    // Second pass writes the neighbor indices into each particle's slice
+    fill_neighbors_kernel<<<this->blocks, this->threads>>>(
+        this->cu_position, this->cu_mass, this->cu_radius, this->cu_neighbor_offset, this->cu_neighbor_index,
+        this->particle_num, this->neighbor_list_skin);
+    check_kernel_error();
+
+    cudaMemcpy(this->cu_reference_position, this->cu_position, this->particle_num * sizeof(glm::vec3),
+               cudaMemcpyDeviceToDevice);
+    this->neighbor_list_valid = true;
+}
+
+void ParticleCuda::check_neighbor_list(const float lookahead_time) {
+    // The list stays valid while no particle can have moved more than half of the skin it was built with.
+    // With continuous collision the whole sweep of the coming step has to be covered as well, and the
+    // longest sweep sizes the skin of the next build.
+    float max_speed_sq = thrust::transform_reduce(thrust::device, this->cu_velocity,
+        this->cu_velocity + this->particle_num, SquaredLength(), 0.0f, thrust::maximum<float>());
+    this->max_sweep = std::sqrt(max_speed_sq) * lookahead_time;
+    compute_displacement_kernel<<<this->blocks, this->threads>>>(
+        this->cu_position, this->cu_reference_position, this->cu_velocity, this->cu_displacement,
+        lookahead_time, this->particle_num);
+    check_kernel_error();
+    float max_displacement_sq = thrust::reduce(thrust::device, this->cu_displacement,
+        this->cu_displacement + this->particle_num, 0.0f, thrust::maximum<float>());
+    float half_skin = this->neighbor_list_skin * 0.5f;
+    if (max_displacement_sq > half_skin * half_skin) {
+        this->neighbor_list_valid = false;
+    }
+}
+
+void ParticleCuda::build_contact_list(const float sweep_time) {
+    // Sleeping particles skip the search, so first wake up those about to touch any other particle
+    if (this->sleep_steps > 0) {
+        wake_touched_kernel<<<this->blocks, this->threads>>>(
+            this->cu_position, this->cu_velocity, this->cu_radius, this->cu_neighbor_offset,
+            this->cu_neighbor_index, this->cu_asleep, this->cu_sleep_counter, this->particle_num, sweep_time);
+        check_kernel_error();
+    }
+
+    // Phase 1: every awake particle emits the neighbors it touches during the sweep
+    count_contacts_kernel<<<this->blocks, this->threads>>>(
+        this->cu_position, this->cu_velocity, this->cu_radius, this->cu_neighbor_offset,
+        this->cu_neighbor_index, this->cu_asleep, this->cu_contact_count, this->cu_contact_seen,
+        this->particle_num, sweep_time);
+    check_kernel_error();
+    int total = scan_offsets(this->cu_contact_count, this->cu_contact_offset);
+    this->contact_num = total;
+    int capacity = grow_capacity(this->contact_capacity, total);
+    if (capacity != this->contact_capacity) {
+        cudaFree(this->cu_contact_index);
+        cudaFree(this->cu_contact_time);
+        cudaMalloc(&this->cu_contact_index, capacity * sizeof(int));
+        cudaMalloc(&this->cu_contact_time, capacity * sizeof(float));
+        this->contact_capacity = capacity;
+    }
+    fill_contacts_kernel<<<this->blocks, this->threads>>>(
+        this->cu_position, this->cu_velocity, this->cu_radius, this->cu_neighbor_offset,
+        this->cu_neighbor_index, this->cu_asleep, this->cu_contact_offset, this->cu_contact_index, this->cu_contact_time,
+        this->particle_num, sweep_time);
+    check_kernel_error();
+}
+
+void ParticleCuda::resolve_contacts(const float delta_time) {
+    // Phase 2: each particle accumulates the impulses of its own contacts into a separate buffer,
+    // then moves with the old velocity up to its time of impact and with the new one afterwards
+    resolve_contacts_kernel<<<this->blocks, this->threads>>>(
+        this->cu_position, this->cu_velocity, this->cu_mass, this->cu_velocity_next, this->cu_impact_time,
+        this->cu_impulse, this->cu_contact_offset, this->cu_contact_index, this->cu_contact_time,
+        this->restitution, this->particle_num);
+    check_kernel_error();
+    drift_kernel<<<this->blocks, this->threads>>>(
+        this->cu_position, this->cu_velocity, this->cu_velocity_next, this->cu_impact_time, delta_time,
+        this->particle_num);
+    check_kernel_error();
+    std::swap(this->cu_velocity, this->cu_velocity_next);
+}
+
+void ParticleCuda::merge_slow_contacts() {
+    // Pairs that touch with a relative speed below accretion_speed stick together as one particle
+    merge_pairs_kernel<<<this->blocks, this->threads>>>(
+        this->cu_position, this->cu_velocity, this->cu_mass, this->cu_radius, this->cu_impulse,
+        this->cu_merge_partner, this->cu_keep, this->particle_num);
+    check_kernel_error();
+
+    int kept = scan_offsets(this->cu_keep, this->cu_new_index);
+    if (kept == this->particle_num) {
+        return;
+    }
+
+    // Remember which particle absorbed which, in indices of the set the host last saw
+    std::vector<int> keep(this->particle_num);
+    std::vector<int> partner(this->particle_num);
+    cudaMemcpy(keep.data(), this->cu_keep, this->particle_num * sizeof(int), cudaMemcpyDeviceToHost);
+    cudaMemcpy(partner.data(), this->cu_merge_partner, this->particle_num * sizeof(int), cudaMemcpyDeviceToHost);
+    for (int i = 0; i < this->particle_num; i++) {
+        if (!keep[i]) {
+            int survivor = this->host_source_index.empty() ? partner[i] : this->host_source_index[partner[i]];
+            int absorbed = this->host_source_index.empty() ? i : this->host_source_index[i];
+            this->host_merged.push_back(std::make_pair(survivor, absorbed));
+        }
+    }
+    compact(kept);
+}
+
+void ParticleCuda::remove_escaped() {
+    // Center of mass of the whole system; the scratch buffers are free at the start of a step
+    mass_moment_kernel<<<this->blocks, this->threads>>>(
+        this->cu_position, this->cu_velocity, this->cu_mass, this->cu_velocity_next,
+        this->cu_previous_acceleration, this->particle_num);
+    check_kernel_error();
+    cudaMemcpy(this->cu_displacement, this->cu_mass, this->particle_num * sizeof(float), cudaMemcpyDeviceToDevice);
+    float total_mass = sum(this->cu_displacement);
+    glm::vec3 position_moment = sum(this->cu_velocity_next);
+    glm::vec3 velocity_moment = sum(this->cu_previous_acceleration);
+    if (total_mass <= 0.0f) {
+        return;
+    }
+
+    flag_escaped_kernel<<<this->blocks, this->threads>>>(
+        this->cu_position, this->cu_velocity, this->cu_mass, position_moment / total_mass,
+        velocity_moment / total_mass, total_mass, this->escape_distance, this->cu_keep, this->particle_num);
+    check_kernel_error();
+    int kept = scan_offsets(this->cu_keep, this->cu_new_index);
+    if (kept == this->particle_num) {
+        return;
+    }
+
+    // Hand the final state of the escaped particles to the host, in indices of the set it last saw
+    std::vector<int> keep(this->particle_num);
+    std::vector<glm::vec3> position(this->particle_num);
+    std::vector<glm::vec3> velocity(this->particle_num);
+    cudaMemcpy(keep.data(), this->cu_keep, this->particle_num * sizeof(int), cudaMemcpyDeviceToHost);
+    cudaMemcpy(position.data(), this->cu_position, this->particle_num * sizeof(glm::vec3),
+               cudaMemcpyDeviceToHost);
+    cudaMemcpy(velocity.data(), this->cu_velocity, this->particle_num * sizeof(glm::vec3),
+               cudaMemcpyDeviceToHost);
+    for (int i = 0; i < this->particle_num; i++) {
+        if (!keep[i]) {
+            int index = this->host_source_index.empty() ? i : this->host_source_index[i];
+            this->host_escaped.push_back({index, position[i], velocity[i]});
+        }
+    }
+    compact(kept);
+}
+
+void ParticleCuda::compact(const int kept) {
+    // Stream compaction of all particle arrays by cu_keep, with cu_new_index already holding the
+    // exclusive scan of the flags. Each array is scattered into a spare buffer of the same capacity,
+    // which then takes the place of the original.
+    compact_kernel<<<this->blocks, this->threads>>>(
+        this->cu_keep, this->cu_new_index, this->cu_position, this->cu_velocity_next, this->particle_num);
+    std::swap(this->cu_position, this->cu_velocity_next);
+    compact_kernel<<<this->blocks, this->threads>>>(
+        this->cu_keep, this->cu_new_index, this->cu_velocity, this->cu_velocity_next, this->particle_num);
+    std::swap(this->cu_velocity, this->cu_velocity_next);
+    compact_kernel<<<this->blocks, this->threads>>>(
+        this->cu_keep, this->cu_new_index, this->cu_mass, this->cu_displacement, this->particle_num);
+    std::swap(this->cu_mass, this->cu_displacement);
+    compact_kernel<<<this->blocks, this->threads>>>(
+        this->cu_keep, this->cu_new_index, this->cu_radius, this->cu_displacement, this->particle_num);
+    std::swap(this->cu_radius, this->cu_displacement);
+    compact_kernel<<<this->blocks, this->threads>>>(
+        this->cu_keep, this->cu_new_index, this->cu_impulse, this->cu_displacement, this->particle_num);
+    std::swap(this->cu_impulse, this->cu_displacement);
+    compact_kernel<<<this->blocks, this->threads>>>(
+        this->cu_keep, this->cu_new_index, this->cu_acceleration, this->cu_velocity_next, this->particle_num);
+    std::swap(this->cu_acceleration, this->cu_velocity_next);
+    compact_kernel<<<this->blocks, this->threads>>>(
+        this->cu_keep, this->cu_new_index, this->cu_contact_seen, this->cu_neighbor_count, this->particle_num);
+    std::swap(this->cu_contact_seen, this->cu_neighbor_count);
+    compact_kernel<<<this->blocks, this->threads>>>(
+        this->cu_keep, this->cu_new_index, this->cu_sleep_counter, this->cu_neighbor_count, this->particle_num);
+    std::swap(this->cu_sleep_counter, this->cu_neighbor_count);
+    compact_kernel<<<this->blocks, this->threads>>>(
+        this->cu_keep, this->cu_new_index, this->cu_asleep, this->cu_neighbor_count, this->particle_num);
+    std::swap(this->cu_asleep, this->cu_neighbor_count);
+    source_index_kernel<<<this->blocks, this->threads>>>(
+        this->cu_keep, this->cu_new_index, this->cu_source_index, this->particle_num);
+    check_kernel_error();
+
+    // Compose with earlier compactions so that the host can remap its own arrays in one go
+    std::vector<int> source_index(kept);
+    cudaMemcpy(source_index.data(), this->cu_source_index, kept * sizeof(int), cudaMemcpyDeviceToHost);
+    if (this->host_source_index.empty()) {
+        this->host_source_index = source_index;
+    } else {
+        for (int k = 0; k < kept; k++) {
+            source_index[k] = this->host_source_index[source_index[k]];
+        }
+        this->host_source_index = source_index;
+    }
+
+    this->particle_num = kept;
+    this->blocks = (kept + this->threads - 1) / this->threads;
+    this->host_mass.resize(kept);
+    this->host_radius.resize(kept);
+    this->host_velocity.resize(kept);
+    cudaMemcpy(this->host_mass.data(), this->cu_mass, kept * sizeof(float), cudaMemcpyDeviceToHost);
+    cudaMemcpy(this->host_radius.data(), this->cu_radius, kept * sizeof(float), cudaMemcpyDeviceToHost);
+    this->acceleration_valid = false;
+    this->neighbor_list_valid = false;
+}
+
+int ParticleCuda::insert_particle(const glm::vec3 &position, const glm::vec3 &velocity, const float mass,
+                                  const float radius) {
+    // Appends one particle and returns its index; the buffers double in size when they are full
+    int index = this->particle_num;
+    if (index + 1 > this->particle_capacity) {
+        reallocate_particle_buffers(grow_capacity(this->particle_capacity, index + 1));
+    }
+    this->particle_num = index + 1;
+    this->blocks = (this->particle_num + this->threads - 1) / this->threads;
+    this->host_mass.push_back(mass);
+    this->host_radius.push_back(radius);
+    this->host_velocity.push_back(velocity);
+    write_particle(index, position, velocity, mass, radius);
+    return index;
+}
+
+void ParticleCuda::write_particle(const int index, const glm::vec3 &position, const glm::vec3 &velocity,
+                                  const float mass, const float radius) {
+    // Overwrites one slot, e.g. to reuse the slot of a removed particle or to turn a particle into a
+    // tombstone with zero mass. The new state can't have settled, so the slot starts awake.
+    cudaMemcpy(this->cu_position + index, &position, sizeof(glm::vec3), cudaMemcpyHostToDevice);
+    cudaMemcpy(this->cu_velocity + index, &velocity, sizeof(glm::vec3), cudaMemcpyHostToDevice);
+    cudaMemcpy(this->cu_mass + index, &mass, sizeof(float), cudaMemcpyHostToDevice);
+    cudaMemcpy(this->cu_radius + index, &radius, sizeof(float), cudaMemcpyHostToDevice);
+    cudaMemset(this->cu_impulse + index, 0, sizeof(float));
+    cudaMemset(this->cu_sleep_counter + index, 0, sizeof(int));
+    cudaMemset(this->cu_asleep + index, 0, sizeof(int));
+    this->host_mass[index] = mass;
+    this->host_radius[index] = radius;
+    this->acceleration_valid = false;
+    this->neighbor_list_valid = false;
+}
+
+void ParticleCuda::remove_tombstones() {
+    // Compacts away the slots whose particles were removed
+    flag_alive_kernel<<<this->blocks, this->threads>>>(this->cu_mass, this->cu_keep, this->particle_num);
+    check_kernel_error();
+    int kept = scan_offsets(this->cu_keep, this->cu_new_index);
+    if (kept < this->particle_num) {
+        compact(kept);
+    }
+}
+
+bool ParticleCuda::take_compaction(std::vector<int> &source_index, std::vector<std::pair<int, int>> &merged,
+                                   std::vector<EscapedParticle> &escaped) {
+    // Hands over how the particle set changed since the last call: source_index[k] is the previous
+    // index of particle k, merged lists (survivor, absorbed) pairs and escaped the removed particles,
+    // both in previous indices
+    if (this->host_source_index.empty()) {
+        return false;
+    }
+    source_index.swap(this->host_source_index);
+    merged.swap(this->host_merged);
+    escaped.swap(this->host_escaped);
+    this->host_source_index.clear();
+    this->host_merged.clear();
+    this->host_escaped.clear();
+    return true;
+}
+
+void ParticleCuda::update_time_stepped(const float delta_time) {
+    // r-RESPA: gravity varies slowly, so it is applied as two half kicks around respa_inner_steps
+    // substeps that only resolve contacts and drift. It is evaluated once per outer step, and the
+    // closing evaluation is reused for the opening kick of the next step.
+    if (!this->acceleration_valid) {
+        compute_gravity(true);
+    }
+    kick(0.5f * delta_time);
+    cudaMemset(this->cu_contact_seen, 0, this->particle_num * sizeof(int));
+
+    float inner_time = delta_time / this->respa_inner_steps;
+    float sweep_time = this->continuous_collision ? inner_time : 0.0f;
+    int max_contact_num = 0;
+    for (int step = 0; step < this->respa_inner_steps; step++) {
+        check_neighbor_list(sweep_time);
+        if (!this->neighbor_list_valid) {
+            build_neighbor_list();
+        }
+        build_contact_list(sweep_time);
+        if (this->accretion_speed > 0.0f) {
+            select_merge_partner_kernel<<<this->blocks, this->threads>>>(
+                this->cu_velocity, this->cu_mass, this->cu_contact_offset, this->cu_contact_index, this->cu_merge_partner,
+                this->accretion_speed, this->particle_num);
+            check_kernel_error();
+        }
+        resolve_contacts(inner_time);
+        if (this->accretion_speed > 0.0f) {
+            merge_slow_contacts();
+        }
+        max_contact_num = std::max(max_contact_num, this->contact_num);
+    }
+
+    // Sleeping particles keep drifting with their last acceleration. Every sleep_check_interval steps
+    // their gravity is evaluated as well, and those whose force changed wake up again.
+    bool sleeping = this->sleep_steps > 0;
+    bool check_sleeping = !sleeping || this->step_num % this->sleep_check_interval == 0;
+    if (sleeping) {
+        cudaMemcpy(this->cu_previous_acceleration, this->cu_acceleration, this->particle_num * sizeof(glm::vec3),
+                   cudaMemcpyDeviceToDevice);
+    }
+    compute_gravity(check_sleeping);
+    if (sleeping) {
+        // The activity test compares velocities with the neighbors, whose indices merges may have shifted
+        if (!this->neighbor_list_valid) {
+            build_neighbor_list();
+        }
+        update_activity_kernel<<<this->blocks, this->threads>>>(
+            this->cu_velocity, this->cu_acceleration, this->cu_previous_acceleration, this->cu_neighbor_offset,
+            this->cu_neighbor_index, this->cu_contact_seen, this->cu_sleep_counter, this->cu_asleep,
+            this->sleep_speed, this->sleep_acceleration, this->sleep_steps, this->particle_num);
+        check_kernel_error();
+    }
+    kick(0.5f * delta_time);
+
+    // Each touching pair appears twice in the contact list. A forced event-driven mode only takes a time
+    // step after a truncated event-driven one.
+    float pairs_per_particle = 0.5f * max_contact_num / std::max(this->particle_num, 1);
+    if (this->event_driven || (this->event_driven_contact_ratio > 0.0f
+        && pairs_per_particle > this->event_driven_contact_ratio)) {
+        this->event_driven_active = true;
+    }
+}
+
+void ParticleCuda::update_event_driven(std::vector<glm::vec3> &position, const float delta_time) {
+    // Gravity is applied as a kick, then the particles move ballistically from collision to collision.
+    // Every particle takes part, so nobody stays asleep.
+    compute_bounds();
+    reset_sleep();
+    compute_gravity(true);
+    kick(delta_time);
+    this->acceleration_valid = false;
+    cudaDeviceSynchronize();
+
+    position.resize(this->particle_num);
+    cudaMemcpy(position.data(), this->cu_position, this->particle_num * sizeof(glm::vec3),
+               cudaMemcpyDeviceToHost);
+    cudaMemcpy(this->host_velocity.data(), this->cu_velocity, this->particle_num * sizeof(glm::vec3),
+               cudaMemcpyDeviceToHost);
+    int collision_num = this->event_solver.advance(position, this->host_velocity, this->host_mass,
+        this->host_radius, this->bounds_min, this->bounds_max, delta_time);
+    cudaMemcpy(this->cu_position, position.data(), this->particle_num * sizeof(glm::vec3),
+               cudaMemcpyHostToDevice);
+    cudaMemcpy(this->cu_velocity, this->host_velocity.data(), this->particle_num * sizeof(glm::vec3),
+               cudaMemcpyHostToDevice);
+
+    compute_bounds();
+
+    // A step that hit the event limit left collisions unresolved, so the next step is time stepped and
+    // resolves the overlaps as contacts. Otherwise fall back once collisions have become rare again.
+    if (this->event_solver.get_truncated()) {
+        this->event_driven_truncations++;
+        std::cerr << "Event-driven step stopped at the event limit after " << collision_num
+                  << " collisions; falling back to time stepping (" << this->event_driven_truncations
+                  << " truncated steps so far)" << std::endl;
+        this->event_driven_active = false;
+        return;
+    }
+    float pairs_per_particle = float(collision_num) / std::max(this->particle_num, 1);
+    if (!this->event_driven && pairs_per_particle < 0.5f * this->event_driven_contact_ratio) {
+        this->event_driven_active = false;
+    }
+}
+
+void ParticleCuda::update_position_velocity(std::vector<glm::vec3> &position, const float delta_time) {
+    if (this->escape_check_interval > 0 && this->step_num % this->escape_check_interval == 0) {
+        remove_escaped();
+    }
+    this->step_num++;
+
+    if (this->event_driven_active) {
+        update_event_driven(position, delta_time);
+        return;
+    }
+
+    update_time_stepped(delta_time);
+    compute_bounds();
     cudaDeviceSynchronize();
 
-    cudaMemcpy(position.data(), this->cu_position, position.size() * sizeof(glm::vec3),
+    position.resize(this->particle_num);
+    cudaMemcpy(position.data(), this->cu_position, this->particle_num * sizeof(glm::vec3),
                cudaMemcpyDeviceToHost);
 }
@@ -6,26 +6,149 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <vector>
+#include <utility>
 #include <iostream>
+#include <limits>
 
 #include "kernel.cuh"
+#include "EventDrivenSolver.hpp"
+#include "ParticleData.hpp"
+#include "SimulationConfig.hpp"
+
+
+// Final state of a particle that left the simulation, with its index in the set the host last saw
+struct EscapedParticle {
+    int index;
+    glm::vec3 position;
+    glm::vec3 velocity;
+};
 
 
 class ParticleCuda {
     private:
         glm::vec3 *cu_position;
         glm::vec3 *cu_velocity;
+        glm::vec3 *cu_velocity_next;
+        glm::vec3 *cu_acceleration;
+        float *cu_mass;
+        float *cu_radius;
+        float *cu_impulse;
         int threads;
         int blocks;
-        float collision_distance;
+        int particle_num;
+        int particle_capacity;
+
+        // Gravity at the current positions, kept between steps for the closing/opening half kicks
+        bool acceleration_valid;
+        int respa_inner_steps;
+
+        // Verlet neighbor lists in CSR layout
+        glm::vec3 *cu_reference_position;
+        float *cu_displacement;
+        int *cu_neighbor_count;
+        int *cu_neighbor_offset;
+        int *cu_neighbor_index;
+        int neighbor_capacity;
+        float neighbor_skin;
+        float neighbor_list_skin;
+        float max_sweep;
+        bool neighbor_list_valid;
+
+        // Contacts of the current step in CSR layout, a subset of the neighbor lists
+        int *cu_contact_count;
+        int *cu_contact_offset;
+        int *cu_contact_index;
+        float *cu_contact_time;
+        int contact_capacity;
+        float *cu_impact_time;
+        bool continuous_collision;
+        int contact_num;
+        float restitution;
+
+        // Accretion of slow pairs and stream compaction of the particle arrays
+        float accretion_speed;
+        int *cu_merge_partner;
+        int *cu_keep;
+        int *cu_new_index;
+        int *cu_source_index;
+        std::vector<int> host_source_index;
+        std::vector<std::pair<int, int>> host_merged;
+
+        // Event-driven hard-sphere mode for the collision-dominated phase
+        EventDrivenSolver event_solver;
+        std::vector<glm::vec3> host_velocity;
+        std::vector<float> host_mass;
+        std::vector<float> host_radius;
+        bool event_driven;
+        bool event_driven_active;
+        float event_driven_contact_ratio;
+        int event_driven_truncations;
+
+        // Sleeping particles skip gravity and contact evaluation until they touch another particle or their
+        // force changes
+        glm::vec3 *cu_previous_acceleration;
+        int *cu_contact_seen;
+        int *cu_sleep_counter;
+        int *cu_asleep;
+        int sleep_steps;
+        float sleep_speed;
+        float sleep_acceleration;
+        int sleep_check_interval;
+        int step_num;
+
+        // Removal of particles that escaped from the system
+        int escape_check_interval;
+        float escape_distance;
+        std::vector<EscapedParticle> host_escaped;
+
+        // Sums in a fixed order that depends only on the particle count
+        bool deterministic;
+
+        // Bounding box of all particles, reduced on the device after every step
+        glm::vec3 bounds_min;
+        glm::vec3 bounds_max;
+
+        void check_kernel_error();
+        void allocate_particle_buffers(const int capacity);
+        void free_particle_buffers();
+        void reallocate_particle_buffers(const int capacity);
+        void compute_gravity(const bool include_asleep);
+        void reset_sleep();
+        void compute_bounds();
+        void kick(const float delta_time);
+        int scan_offsets(const int *cu_count, int *cu_offset);
+        int grow_capacity(const int capacity, const int required);
+        glm::vec3 sum(glm::vec3 *cu_value);
+        float sum(float *cu_value);
+        void build_neighbor_list();
+        void check_neighbor_list(const float lookahead_time);
+        void build_contact_list(const float sweep_time);
+        void resolve_contacts(const float delta_time);
+        void merge_slow_contacts();
+        void remove_escaped();
+        void compact(const int kept);
+        void update_time_stepped(const float delta_time);
+        void update_event_driven(std::vector<glm::vec3> &position, const float delta_time);
 
     public:
         ParticleCuda();
         ~ParticleCuda();
 
-        void initialize(const std::vector<glm::vec3> &position, const std::vector<glm::vec3> &velocity,
-                    const int particle_num, const int threads, const float collision_distance);
-        void update_position_velocity(std::vector<glm::vec3> &position, const float mass, const float delta_time);
+        void initialize(const ParticleData &data, const int threads, const SimulationConfig &config);
+        void upload(const ParticleData &data);
+        void download(ParticleData &data, std::vector<float> &impulse);
+        void download_acceleration(std::vector<glm::vec3> &acceleration);
+        void update_position_velocity(std::vector<glm::vec3> &position, const float delta_time);
+        int insert_particle(const glm::vec3 &position, const glm::vec3 &velocity, const float mass,
+                            const float radius);
+        void write_particle(const int index, const glm::vec3 &position, const glm::vec3 &velocity,
+                            const float mass, const float radius);
+        void remove_tombstones();
+        void get_bounds(glm::vec3 &min_bound, glm::vec3 &max_bound);
+        void get_mass_radius(std::vector<float> &mass, std::vector<float> &radius);
+        int get_event_driven_truncations();
+        bool take_compaction(std::vector<int> &source_index, std::vector<std::pair<int, int>> &merged,
+                             std::vector<EscapedParticle> &escaped);
 };
 
 #endif
@@ -0,0 +1,239 @@
+#include "ParticleCulling.hpp"
+
+
+// Average number of particles per chunk, and the largest grid along each axis
+const int PARTICLES_PER_CHUNK = 512;
+const int MAX_CHUNK_DIM = 32;
+// Pixels per side of a block of the finest depth pyramid level
+const int DEPTH_BLOCK = 4;
+
+ParticleCulling::ParticleCulling() {
+    this->chunk_num = 0;
+}
+
+ParticleCulling::~ParticleCulling() {
+}
+
+void ParticleCulling::build(const std::vector<glm::vec3> &position, const std::vector<float> &radius) {
+    int n = position.size();
+    glm::vec3 min_bound(std::numeric_limits<float>::max());
+    glm::vec3 max_bound(-std::numeric_limits<float>::max());
+    for (int i = 0; i < n; i++) {
+        min_bound = glm::min(min_bound, position[i]);
+        max_bound = glm::max(max_bound, position[i]);
+    }
+    int dim = std::clamp(int(std::cbrt(float(n / PARTICLES_PER_CHUNK))), 1, MAX_CHUNK_DIM);
+    glm::vec3 cell_size = glm::max((max_bound - min_bound) / float(dim), glm::vec3(1e-6f));
+    this->chunk_num = dim * dim * dim;
+
+    // Counting sort of the particles by chunk
+    this->chunk_of.resize(n);
+    this->chunk_offset.assign(this->chunk_num + 1, 0);
+    for (int i = 0; i < n; i++) {
+        glm::ivec3 cell = glm::clamp(glm::ivec3((position[i] - min_bound) / cell_size), 0, dim - 1);
+        this->chunk_of[i] = (cell.z * dim + cell.y) * dim + cell.x;
+        this->chunk_offset[this->chunk_of[i] + 1]++;
+    }
+    for (int c = 0; c < this->chunk_num; c++) {
+        this->chunk_offset[c + 1] += this->chunk_offset[c];
+    }
+    std::vector<int> next(this->chunk_offset.begin(), this->chunk_offset.end() - 1);
+    this->order.resize(n);
+    for (int i = 0; i < n; i++) {
+        this->order[next[this->chunk_of[i]]++] = i;
+    }
+
+    // Tight bounds of the spheres in each chunk, which may reach into the neighboring cells
+    this->chunk_min_x.assign(this->chunk_num, std::numeric_limits<float>::max());
+    this->chunk_min_y.assign(this->chunk_num, std::numeric_limits<float>::max());
+    this->chunk_min_z.assign(this->chunk_num, std::numeric_limits<float>::max());
+    this->chunk_max_x.assign(this->chunk_num, -std::numeric_limits<float>::max());
+    this->chunk_max_y.assign(this->chunk_num, -std::numeric_limits<float>::max());
+    this->chunk_max_z.assign(this->chunk_num, -std::numeric_limits<float>::max());
+    for (int i = 0; i < n; i++) {
+        int c = this->chunk_of[i];
+        this->chunk_min_x[c] = std::min(this->chunk_min_x[c], position[i].x - radius[i]);
+        this->chunk_min_y[c] = std::min(this->chunk_min_y[c], position[i].y - radius[i]);
+        this->chunk_min_z[c] = std::min(this->chunk_min_z[c], position[i].z - radius[i]);
+        this->chunk_max_x[c] = std::max(this->chunk_max_x[c], position[i].x + radius[i]);
+        this->chunk_max_y[c] = std::max(this->chunk_max_y[c], position[i].y + radius[i]);
+        this->chunk_max_z[c] = std::max(this->chunk_max_z[c], position[i].z + radius[i]);
+    }
+    this->chunk_scale_x.resize(this->chunk_num);
+    this->chunk_scale_y.resize(this->chunk_num);
+    this->chunk_scale_z.resize(this->chunk_num);
+    for (int c = 0; c < this->chunk_num; c++) {
+        this->chunk_scale_x[c] = 65535.0f / std::max(this->chunk_max_x[c] - this->chunk_min_x[c], 1e-12f);
+        this->chunk_scale_y[c] = 65535.0f / std::max(this->chunk_max_y[c] - this->chunk_min_y[c], 1e-12f);
+        this->chunk_scale_z[c] = 65535.0f / std::max(this->chunk_max_z[c] - this->chunk_min_z[c], 1e-12f);
+    }
+}
+
+void ParticleCulling::cull(const glm::mat4 &view_projection, std::vector<int> &visible) {
+    // Frustum planes from the rows of the view-projection matrix. A box is outside if its corner farthest
+    // along the plane normal is behind the plane.
+    glm::vec4 row[4];
+    for (int r = 0; r < 4; r++) {
+        row[r] = glm::vec4(view_projection[0][r], view_projection[1][r], view_projection[2][r], view_projection[3][r]);
+    }
+    std::array<glm::vec4, 6> plane = {
+        row[3] + row[0], row[3] - row[0],
+        row[3] + row[1], row[3] - row[1],
+        row[3] + row[2], row[3] - row[2]
+    };
+
+    this->chunk_visible.resize(this->chunk_num);
+    for (int c = 0; c < this->chunk_num; c++) {
+        this->chunk_visible[c] = this->chunk_offset[c + 1] > this->chunk_offset[c];
+    }
+    for (const glm::vec4 &p : plane) {
+        const float *x = p.x > 0.0f ? this->chunk_max_x.data() : this->chunk_min_x.data();
+        const float *y = p.y > 0.0f ? this->chunk_max_y.data() : this->chunk_min_y.data();
+        const float *z = p.z > 0.0f ? this->chunk_max_z.data() : this->chunk_min_z.data();
+        unsigned char *chunk_visible = this->chunk_visible.data();
+        for (int c = 0; c < this->chunk_num; c++) {
+            chunk_visible[c] &= p.x * x[c] + p.y * y[c] + p.z * z[c] + p.w >= 0.0f;
+        }
+    }
+    if (!this->depth_pyramid.empty()) {
+        for (int c = 0; c < this->chunk_num; c++) {
+            if (this->chunk_visible[c] && is_occluded(c)) {
+                this->chunk_visible[c] = 0;
+            }
+        }
+    }
+
+    visible.clear();
+    for (int c = 0; c < this->chunk_num; c++) {
+        if (this->chunk_visible[c]) {
+            visible.insert(visible.end(), this->order.begin() + this->chunk_offset[c],
+                this->order.begin() + this->chunk_offset[c + 1]);
+        }
+    }
+}
+
+void ParticleCulling::encode_positions(const std::vector<int> &particle, const std::vector<glm::vec3> &position,
+    std::vector<glm::u16vec4> &quantized) {
+    // 16-bit fixed point relative to the bounds of the chunk of each particle, with the chunk in w. The
+    // scales per chunk come from build, so this is a single pass that reads each particle once.
+    int n = particle.size();
+    quantized.resize(n);
+    const float *min_x = this->chunk_min_x.data();
+    const float *min_y = this->chunk_min_y.data();
+    const float *min_z = this->chunk_min_z.data();
+    const float *scale_x = this->chunk_scale_x.data();
+    const float *scale_y = this->chunk_scale_y.data();
+    const float *scale_z = this->chunk_scale_z.data();
+    for (int k = 0; k < n; k++) {
+        int i = particle[k];
+        int c = this->chunk_of[i];
+        const glm::vec3 &p = position[i];
+        glm::u16vec4 &q = quantized[k];
+        q.x = (unsigned short)std::min((p.x - min_x[c]) * scale_x[c] + 0.5f, 65535.0f);
+        q.y = (unsigned short)std::min((p.y - min_y[c]) * scale_y[c] + 0.5f, 65535.0f);
+        q.z = (unsigned short)std::min((p.z - min_z[c]) * scale_z[c] + 0.5f, 65535.0f);
+        q.w = c;
+    }
+}
+
+void ParticleCulling::get_chunk_bounds(std::vector<glm::vec4> &bounds) {
+    // Two texels per chunk for decoding: the low corner, and the size of one quantization step
+    bounds.resize(2 * this->chunk_num);
+    for (int c = 0; c < this->chunk_num; c++) {
+        glm::vec3 low(this->chunk_min_x[c], this->chunk_min_y[c], this->chunk_min_z[c]);
+        glm::vec3 high(this->chunk_max_x[c], this->chunk_max_y[c], this->chunk_max_z[c]);
+        bounds[2 * c] = glm::vec4(low, 0.0f);
+        bounds[2 * c + 1] = glm::vec4(glm::max(high - low, glm::vec3(0.0f)) / 65535.0f, 0.0f);
+    }
+}
+
+void ParticleCulling::set_depth(const float *depth, const int width, const int height,
+    const glm::mat4 &view_projection) {
+    // Window depth of the whole viewport, rows from the bottom as read by glReadPixels. Each texel of the
+    // pyramid holds the farthest depth of the pixels it covers.
+    this->depth_view_projection = view_projection;
+    this->depth_viewport = glm::vec2(width, height);
+    glm::ivec2 size((width + DEPTH_BLOCK - 1) / DEPTH_BLOCK, (height + DEPTH_BLOCK - 1) / DEPTH_BLOCK);
+    this->pyramid_size.assign(1, size);
+    this->depth_pyramid.resize(1);
+    std::vector<float> &base = this->depth_pyramid[0];
+    base.assign(size.x * size.y, 0.0f);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            float &texel = base[(y / DEPTH_BLOCK) * size.x + x / DEPTH_BLOCK];
+            texel = std::max(texel, depth[y * width + x]);
+        }
+    }
+
+    while (size.x > 1 || size.y > 1) {
+        glm::ivec2 next_size((size.x + 1) / 2, (size.y + 1) / 2);
+        const std::vector<float> &level = this->depth_pyramid.back();
+        std::vector<float> next(next_size.x * next_size.y);
+        for (int y = 0; y < next_size.y; y++) {
+            int y0 = 2 * y;
+            int y1 = std::min(2 * y + 1, size.y - 1);
+            for (int x = 0; x < next_size.x; x++) {
+                int x0 = 2 * x;
+                int x1 = std::min(2 * x + 1, size.x - 1);
+                next[y * next_size.x + x] = std::max(
+                    std::max(level[y0 * size.x + x0], level[y0 * size.x + x1]),
+                    std::max(level[y1 * size.x + x0], level[y1 * size.x + x1]));
+            }
+        }
+        this->depth_pyramid.push_back(std::move(next));
+        this->pyramid_size.push_back(next_size);
+        size = next_size;
+    }
+}
+
+void ParticleCulling::clear_depth() {
+    this->depth_pyramid.clear();
+    this->pyramid_size.clear();
+}
+
+bool ParticleCulling::is_occluded(const int chunk) {
+    // Screen rectangle and nearest depth of the chunk bounds, seen by the camera of the depth buffer. A
+    // box reaching behind that camera can't be tested.
+    glm::vec2 min_ndc(std::numeric_limits<float>::max());
+    glm::vec2 max_ndc(-std::numeric_limits<float>::max());
+    float min_depth = std::numeric_limits<float>::max();
+    for (int corner = 0; corner < 8; corner++) {
+        glm::vec4 pos((corner & 1) ? this->chunk_max_x[chunk] : this->chunk_min_x[chunk],
+                      (corner & 2) ? this->chunk_max_y[chunk] : this->chunk_min_y[chunk],
+                      (corner & 4) ? this->chunk_max_z[chunk] : this->chunk_min_z[chunk], 1.0f);
+        glm::vec4 clip = this->depth_view_projection * pos;
+        if (clip.w <= 1e-6f) {
+            return false;
+        }
+        glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        min_ndc = glm::min(min_ndc, glm::vec2(ndc));
+        max_ndc = glm::max(max_ndc, glm::vec2(ndc));
+        min_depth = std::min(min_depth, ndc.z * 0.5f + 0.5f);
+    }
+    min_ndc = glm::clamp(min_ndc, -1.0f, 1.0f);
+    max_ndc = glm::clamp(max_ndc, -1.0f, 1.0f);
+
+    // Coarsest level at which the rectangle spans at most 2x2 texels
+    glm::ivec2 size = this->pyramid_size[0];
+    glm::ivec2 low = glm::clamp(glm::ivec2((min_ndc * 0.5f + 0.5f) * this->depth_viewport) / DEPTH_BLOCK,
+        glm::ivec2(0), size - 1);
+    glm::ivec2 high = glm::clamp(glm::ivec2((max_ndc * 0.5f + 0.5f) * this->depth_viewport) / DEPTH_BLOCK,
+        glm::ivec2(0), size - 1);
+    int level = 0;
+    while ((high.x - low.x > 1 || high.y - low.y > 1) && level + 1 < int(this->depth_pyramid.size())) {
+        low /= 2;
+        high /= 2;
+        level++;
+    }
+
+    size = this->pyramid_size[level];
+    const std::vector<float> &depth = this->depth_pyramid[level];
+    for (int y = low.y; y <= high.y; y++) {
+        for (int x = low.x; x <= high.x; x++) {
+            if (min_depth <= depth[y * size.x + x]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
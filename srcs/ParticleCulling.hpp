@@ -0,0 +1,56 @@
+#ifndef PARTICLECULLING_HPP
+#define PARTICLECULLING_HPP
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+
+// Splits the particles of a frame into chunks on a uniform grid over their bounds, and finds the chunks
+// whose bounding box intersects the view frustum. The chunk bounds are kept as separate x/y/z arrays so
+// that the plane tests over all chunks vectorize. Given a depth buffer of an earlier frame, chunks that
+// were entirely behind it are skipped as well, using a pyramid of the farthest depth per block.
+class ParticleCulling {
+    private:
+        int chunk_num;
+        std::vector<int> chunk_of;
+        std::vector<int> chunk_offset;
+        std::vector<int> order;
+        std::vector<float> chunk_min_x;
+        std::vector<float> chunk_min_y;
+        std::vector<float> chunk_min_z;
+        std::vector<float> chunk_max_x;
+        std::vector<float> chunk_max_y;
+        std::vector<float> chunk_max_z;
+        // Quantization steps per unit length of each chunk for encode_positions
+        std::vector<float> chunk_scale_x;
+        std::vector<float> chunk_scale_y;
+        std::vector<float> chunk_scale_z;
+        std::vector<unsigned char> chunk_visible;
+
+        // Hierarchical depth of the frame given to set_depth, each level half the size of the one before
+        std::vector<std::vector<float>> depth_pyramid;
+        std::vector<glm::ivec2> pyramid_size;
+        glm::mat4 depth_view_projection;
+        glm::vec2 depth_viewport;
+
+        bool is_occluded(const int chunk);
+
+    public:
+        ParticleCulling();
+        ~ParticleCulling();
+
+        void build(const std::vector<glm::vec3> &position, const std::vector<float> &radius);
+        void cull(const glm::mat4 &view_projection, std::vector<int> &visible);
+        void encode_positions(const std::vector<int> &particle, const std::vector<glm::vec3> &position,
+                              std::vector<glm::u16vec4> &quantized);
+        void get_chunk_bounds(std::vector<glm::vec4> &bounds);
+        void set_depth(const float *depth, const int width, const int height, const glm::mat4 &view_projection);
+        void clear_depth();
+};
+
+#endif
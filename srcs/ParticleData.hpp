@@ -0,0 +1,23 @@
+#ifndef PARTICLEDATA_HPP
+#define PARTICLEDATA_HPP
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp>
+#include <vector>
+
+
+// Host copy of the per-particle state. All arrays have the same length, and a particle keeps its
+// id when the arrays are reordered or compacted. Ids are never reused; next_id is the next free one.
+// A slot with zero mass is a tombstone of a removed particle that waits for compaction. The shade is
+// the palette of a particle and its position along the palette gradient, from 0 to 255.
+struct ParticleData {
+    std::vector<glm::vec3> position;
+    std::vector<glm::vec3> velocity;
+    std::vector<float> mass;
+    std::vector<float> radius;
+    std::vector<glm::u8vec2> shade;
+    std::vector<long long> id;
+    long long next_id = 0;
+};
+
+#endif
@@ -0,0 +1,457 @@
+#include "ParticleRenderer.hpp"
+
+
+// Smallest projected radius in pixels drawn at each level of detail; anything smaller is a single pixel
+const float LOD_MESH_PIXELS = 24.0f;
+const float LOD_LOW_POLY_PIXELS = 8.0f;
+const float LOD_IMPOSTOR_PIXELS = 1.0f;
+// Uniform buffer binding of the palettes
+const unsigned int PALETTE_BINDING = 0;
+// Texture unit of the chunk bounds for quantized positions
+const int CHUNK_BOUNDS_UNIT = 1;
+// Texture unit of the splat accumulation buffer while tone mapping
+const int SPLAT_UNIT = 2;
+
+ParticleRenderer::ParticleRenderer(const std::vector<float> &mesh_vertices,
+    const std::vector<float> &low_poly_vertices, const int viewport_width, const int viewport_height)
+    : mesh_shader("../shaders/particle.vs", "../shaders/particle.fs", "../shaders/particle_common.glsl"),
+      impostor_shader("../shaders/particle_impostor.vs", "../shaders/particle_impostor.fs",
+                      "../shaders/particle_common.glsl"),
+      splat_shader("../shaders/particle_splat.vs", "../shaders/particle_splat.fs", "../shaders/particle_common.glsl"),
+      splat_tonemap_shader("../shaders/splat_tonemap.vs", "../shaders/splat_tonemap.fs") {
+    this->viewport_width = viewport_width;
+    this->viewport_height = viewport_height;
+    this->impostors = true;
+    this->lod = true;
+    this->culling = true;
+    this->occlusion = true;
+    this->quantized = false;
+    this->splatting = false;
+    this->splat_gaussian = true;
+    this->splat_exposure = 1.0f;
+    this->splat_white_density = 64.0f;
+    this->depth_pending = false;
+    this->position = nullptr;
+    this->shade = nullptr;
+    this->radius = nullptr;
+    this->bucket_offset.fill(0);
+
+    glGenBuffers(1, &this->position_VBO);
+    glGenBuffers(1, &this->shade_VBO);
+    glGenBuffers(1, &this->radius_VBO);
+    glGenBuffers(1, &this->depth_PBO);
+    glGenBuffers(1, &this->quantized_VBO);
+    glGenBuffers(1, &this->chunk_bounds_TBO);
+    glGenTextures(1, &this->chunk_bounds_texture);
+
+    // std140 lays out each color stop as a vec4
+    glGenBuffers(1, &this->palette_UBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, this->palette_UBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(glm::vec4) * MAX_PALETTES * PALETTE_STOPS, NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, PALETTE_BINDING, this->palette_UBO);
+    for (Shader *shader : {&this->mesh_shader, &this->impostor_shader, &this->splat_shader}) {
+        shader->bindUniformBlock("Palette", PALETTE_BINDING);
+        shader->bindUniformBlock("Camera", CAMERA_BINDING);
+        shader->use();
+        shader->setInt("chunkBounds", CHUNK_BOUNDS_UNIT);
+    }
+
+    // Unit spheres scaled by the radius of each instance, one quad per instance for the impostors, and a
+    // single vertex at the center for the points
+    std::vector<float> quad_corners = {
+        -1.0f, -1.0f,
+        1.0f, -1.0f,
+        -1.0f, 1.0f,
+        1.0f, 1.0f
+    };
+    std::vector<float> point = {0.0f, 0.0f, 0.0f};
+    create_mesh(this->meshes[LOD_MESH], mesh_vertices, 3, GL_TRIANGLE_FAN);
+    create_mesh(this->meshes[LOD_LOW_POLY], low_poly_vertices, 3, GL_TRIANGLE_FAN);
+    create_mesh(this->meshes[LOD_IMPOSTOR], quad_corners, 2, GL_TRIANGLE_STRIP);
+    create_mesh(this->meshes[LOD_POINT], point, 3, GL_POINTS);
+
+    // Accumulation buffer of the splats; the tone mapping pass needs a bound VAO but no vertices
+    glGenFramebuffers(1, &this->splat_FBO);
+    glGenTextures(1, &this->splat_texture);
+    glGenVertexArrays(1, &this->empty_VAO);
+    resize_splat_target();
+}
+
+ParticleRenderer::~ParticleRenderer() {
+    for (InstancedMesh &mesh : this->meshes) {
+        glDeleteVertexArrays(1, &mesh.VAO);
+        glDeleteBuffers(1, &mesh.VBO);
+    }
+    glDeleteBuffers(1, &this->position_VBO);
+    glDeleteBuffers(1, &this->shade_VBO);
+    glDeleteBuffers(1, &this->palette_UBO);
+    glDeleteBuffers(1, &this->radius_VBO);
+    glDeleteBuffers(1, &this->depth_PBO);
+    glDeleteBuffers(1, &this->quantized_VBO);
+    glDeleteBuffers(1, &this->chunk_bounds_TBO);
+    glDeleteTextures(1, &this->chunk_bounds_texture);
+    glDeleteFramebuffers(1, &this->splat_FBO);
+    glDeleteTextures(1, &this->splat_texture);
+    glDeleteVertexArrays(1, &this->empty_VAO);
+}
+
+void ParticleRenderer::create_mesh(InstancedMesh &mesh, const std::vector<float> &vertices, const int components,
+    const GLenum mode) {
+    mesh.vertex_num = vertices.size() / components;
+    mesh.mode = mode;
+    glGenVertexArrays(1, &mesh.VAO);
+    glGenBuffers(1, &mesh.VBO);
+    glBindVertexArray(mesh.VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.VBO);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(0, components, GL_FLOAT, GL_FALSE, components * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    set_instance_attributes(0);
+    glBindVertexArray(0);
+}
+
+void ParticleRenderer::set_instance_attributes(const int first_instance) {
+    // Per-instance position, shade and radius of the currently bound VAO, starting at first_instance.
+    // Base instance draws need GL 4.2, so each bucket moves the attribute pointers instead. Positions are
+    // either floats or quantized; the shaders read the one that is enabled.
+    if (this->quantized) {
+        glDisableVertexAttribArray(1);
+        glEnableVertexAttribArray(4);
+        glBindBuffer(GL_ARRAY_BUFFER, this->quantized_VBO);
+        glVertexAttribIPointer(4, 4, GL_UNSIGNED_SHORT, sizeof(glm::u16vec4),
+            (void*)(first_instance * sizeof(glm::u16vec4)));
+        glVertexAttribDivisor(4, 1);
+    } else {
+        glDisableVertexAttribArray(4);
+        glEnableVertexAttribArray(1);
+        glBindBuffer(GL_ARRAY_BUFFER, this->position_VBO);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float),
+            (void*)(first_instance * sizeof(glm::vec3)));
+        glVertexAttribDivisor(1, 1);
+    }
+
+    glEnableVertexAttribArray(2);
+    glBindBuffer(GL_ARRAY_BUFFER, this->shade_VBO);
+    glVertexAttribIPointer(2, 2, GL_UNSIGNED_BYTE, sizeof(glm::u8vec2), (void*)(first_instance * sizeof(glm::u8vec2)));
+    glVertexAttribDivisor(2, 1);
+
+    glEnableVertexAttribArray(3);
+    glBindBuffer(GL_ARRAY_BUFFER, this->radius_VBO);
+    glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)(first_instance * sizeof(float)));
+    glVertexAttribDivisor(3, 1);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void ParticleRenderer::upload(const std::vector<glm::vec3> &position, const std::vector<glm::u8vec2> &shade,
+    const std::vector<float> &radius) {
+    // The buffers are filled in draw, once the camera of the frame is known. The arrays are only
+    // referenced, not copied, so they must stay unchanged until then.
+    this->position = &position;
+    this->shade = &shade;
+    this->radius = &radius;
+}
+
+void ParticleRenderer::set_palette(const std::vector<glm::vec3> &stops) {
+    std::vector<glm::vec4> padded;
+    for (const glm::vec3 &stop : stops) {
+        padded.push_back(glm::vec4(stop, 1.0f));
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, this->palette_UBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::vec4) * padded.size(), padded.data());
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+int ParticleRenderer::select_lod(const glm::vec3 &position, const float radius, const glm::mat4 &view,
+    const glm::mat4 &projection) {
+    // Projected radius in pixels: projection[1][1] is the cotangent of half the vertical field of view.
+    // Particles behind the camera get -1 and are not drawn.
+    float depth = -(view[0][2] * position.x + view[1][2] * position.y + view[2][2] * position.z + view[3][2]);
+    if (depth + radius <= 0.0f) {
+        return -1;
+    }
+    float pixels = radius * projection[1][1] * 0.5f * this->viewport_height / std::max(depth, radius);
+    if (pixels >= LOD_MESH_PIXELS) {
+        return LOD_MESH;
+    }
+    if (pixels >= LOD_LOW_POLY_PIXELS) {
+        return LOD_LOW_POLY;
+    }
+    if (pixels >= LOD_IMPOSTOR_PIXELS) {
+        return LOD_IMPOSTOR;
+    }
+    return LOD_POINT;
+}
+
+void ParticleRenderer::request_depth(const glm::mat4 &view_projection) {
+    // Copies the depth buffer into the pixel buffer without waiting; it is read in the next frame
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, this->depth_PBO);
+    glBufferData(GL_PIXEL_PACK_BUFFER, sizeof(float) * this->viewport_width * this->viewport_height, NULL,
+        GL_STREAM_READ);
+    glReadPixels(0, 0, this->viewport_width, this->viewport_height, GL_DEPTH_COMPONENT, GL_FLOAT, (void*)0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    this->depth_view_projection = view_projection;
+    this->depth_pending = true;
+}
+
+void ParticleRenderer::read_depth() {
+    if (!this->depth_pending) {
+        return;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, this->depth_PBO);
+    float *depth = (float *)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    if (depth) {
+        this->particle_culling.set_depth(depth, this->viewport_width, this->viewport_height,
+            this->depth_view_projection);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    this->depth_pending = false;
+}
+
+void ParticleRenderer::find_visible(const glm::mat4 &view, const glm::mat4 &projection) {
+    // Quantized positions need the chunks even without culling
+    if (this->culling || this->quantized) {
+        this->particle_culling.build(*this->position, *this->radius);
+    }
+    if (this->culling) {
+        // The depth buffer holds no particles while splatting
+        if (this->occlusion && !this->splatting) {
+            read_depth();
+        } else {
+            this->particle_culling.clear_depth();
+        }
+        this->particle_culling.cull(projection * view, this->visible);
+    } else {
+        this->visible.resize(this->position->size());
+        for (size_t i = 0; i < this->visible.size(); i++) {
+            this->visible[i] = i;
+        }
+    }
+}
+
+void ParticleRenderer::sort_by_lod(const glm::mat4 &view, const glm::mat4 &projection) {
+    // Counting sort of the visible instances by level of detail, so that each bucket is a contiguous range.
+    // Without level of detail they all go into the impostor or the mesh bucket, and splats into the point one.
+    const std::vector<glm::vec3> &position = *this->position;
+    const std::vector<glm::u8vec2> &shade = *this->shade;
+    const std::vector<float> &radius = *this->radius;
+    int n = this->visible.size();
+    bool lod = this->lod && !this->splatting;
+    int fixed_level = this->splatting ? LOD_POINT : (this->impostors ? LOD_IMPOSTOR : LOD_MESH);
+    std::vector<signed char> level(n);
+    std::array<int, LOD_NUM> count;
+    count.fill(0);
+    for (int k = 0; k < n; k++) {
+        int i = this->visible[k];
+        level[k] = lod ? select_lod(position[i], radius[i], view, projection) : fixed_level;
+        if (level[k] >= 0) {
+            count[level[k]]++;
+        }
+    }
+
+    this->bucket_offset[0] = 0;
+    for (int lod = 0; lod < LOD_NUM; lod++) {
+        this->bucket_offset[lod + 1] = this->bucket_offset[lod] + count[lod];
+    }
+    std::array<int, LOD_NUM> next;
+    std::copy(this->bucket_offset.begin(), this->bucket_offset.end() - 1, next.begin());
+    int drawn = this->bucket_offset[LOD_NUM];
+    this->sorted_particle.resize(drawn);
+    this->sorted_position.resize(this->quantized ? 0 : drawn);
+    this->sorted_shade.resize(drawn);
+    this->sorted_radius.resize(drawn);
+    for (int k = 0; k < n; k++) {
+        if (level[k] < 0) {
+            continue;
+        }
+        int i = this->visible[k];
+        int j = next[level[k]]++;
+        this->sorted_particle[j] = i;
+        if (!this->quantized) {
+            this->sorted_position[j] = position[i];
+        }
+        this->sorted_shade[j] = shade[i];
+        this->sorted_radius[j] = radius[i];
+    }
+}
+
+void ParticleRenderer::draw_bucket(const int lod, const int first_instance, const int instance_num) {
+    if (instance_num == 0) {
+        return;
+    }
+    // Impostors need 4 vertices per particle instead of the whole mesh
+    Shader &shader = lod == LOD_IMPOSTOR ? this->impostor_shader : this->mesh_shader;
+    shader.use();
+    shader.setBool("quantized", this->quantized);
+    const InstancedMesh &mesh = this->meshes[lod];
+    glBindVertexArray(mesh.VAO);
+    set_instance_attributes(first_instance);
+    glDrawArraysInstanced(mesh.mode, 0, mesh.vertex_num, instance_num);
+    glBindVertexArray(0);
+}
+
+void ParticleRenderer::upload_instances() {
+    if (this->quantized) {
+        this->particle_culling.encode_positions(this->sorted_particle, *this->position, this->sorted_quantized);
+        glBindBuffer(GL_ARRAY_BUFFER, this->quantized_VBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(glm::u16vec4) * this->sorted_quantized.size(),
+            this->sorted_quantized.data(), GL_STREAM_DRAW);
+        this->particle_culling.get_chunk_bounds(this->chunk_bounds);
+        glBindBuffer(GL_TEXTURE_BUFFER, this->chunk_bounds_TBO);
+        glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::vec4) * this->chunk_bounds.size(), this->chunk_bounds.data(),
+            GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        glActiveTexture(GL_TEXTURE0 + CHUNK_BOUNDS_UNIT);
+        glBindTexture(GL_TEXTURE_BUFFER, this->chunk_bounds_texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, this->chunk_bounds_TBO);
+        glActiveTexture(GL_TEXTURE0);
+    } else {
+        glBindBuffer(GL_ARRAY_BUFFER, this->position_VBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * this->sorted_position.size(),
+            this->sorted_position.data(), GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, this->shade_VBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(glm::u8vec2) * this->sorted_shade.size(), this->sorted_shade.data(),
+        GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, this->radius_VBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * this->sorted_radius.size(), this->sorted_radius.data(),
+        GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void ParticleRenderer::draw(const glm::mat4 &view, const glm::mat4 &projection) {
+    if (!this->position) {
+        return;
+    }
+    find_visible(view, projection);
+    sort_by_lod(view, projection);
+    upload_instances();
+
+    if (this->splatting) {
+        draw_splats();
+        return;
+    }
+    for (int lod = 0; lod < LOD_NUM; lod++) {
+        draw_bucket(lod, this->bucket_offset[lod], this->bucket_offset[lod + 1] - this->bucket_offset[lod]);
+    }
+    if (this->culling && this->occlusion) {
+        request_depth(projection * view);
+    }
+}
+
+void ParticleRenderer::resize_splat_target() {
+    glBindTexture(GL_TEXTURE_2D, this->splat_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, this->viewport_width, this->viewport_height, 0, GL_RGBA, GL_FLOAT,
+        NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, this->splat_FBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->splat_texture, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cout << "Error: Splat framebuffer is not complete" << std::endl;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void ParticleRenderer::draw_splats() {
+    // Additive point sprites without depth test, so the cost doesn't depend on overlap or order
+    glBindFramebuffer(GL_FRAMEBUFFER, this->splat_FBO);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    glEnable(GL_PROGRAM_POINT_SIZE);
+
+    int instance_num = this->bucket_offset[LOD_POINT + 1] - this->bucket_offset[LOD_POINT];
+    if (instance_num > 0) {
+        this->splat_shader.use();
+        this->splat_shader.setBool("quantized", this->quantized);
+        this->splat_shader.setBool("gaussian", this->splat_gaussian);
+        const InstancedMesh &mesh = this->meshes[LOD_POINT];
+        glBindVertexArray(mesh.VAO);
+        set_instance_attributes(this->bucket_offset[LOD_POINT]);
+        glDrawArraysInstanced(GL_POINTS, 0, 1, instance_num);
+    }
+
+    glDisable(GL_PROGRAM_POINT_SIZE);
+    glDisable(GL_BLEND);
+    glEnable(GL_DEPTH_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    // Log tone mapping onto the screen
+    this->splat_tonemap_shader.use();
+    this->splat_tonemap_shader.setInt("accumulation", SPLAT_UNIT);
+    this->splat_tonemap_shader.setFloat("exposure", this->splat_exposure);
+    this->splat_tonemap_shader.setFloat("whiteDensity", this->splat_white_density);
+    glActiveTexture(GL_TEXTURE0 + SPLAT_UNIT);
+    glBindTexture(GL_TEXTURE_2D, this->splat_texture);
+    glBindVertexArray(this->empty_VAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void ParticleRenderer::set_viewport(const int width, const int height) {
+    this->viewport_width = width;
+    this->viewport_height = height;
+    // A depth buffer of the old size no longer matches
+    this->depth_pending = false;
+    this->particle_culling.clear_depth();
+    resize_splat_target();
+}
+
+void ParticleRenderer::set_impostors(const bool impostors) {
+    this->impostors = impostors;
+}
+
+bool ParticleRenderer::get_impostors() {
+    return this->impostors;
+}
+
+void ParticleRenderer::set_lod(const bool lod) {
+    this->lod = lod;
+}
+
+bool ParticleRenderer::get_lod() {
+    return this->lod;
+}
+
+void ParticleRenderer::set_culling(const bool culling) {
+    this->culling = culling;
+}
+
+bool ParticleRenderer::get_culling() {
+    return this->culling;
+}
+
+void ParticleRenderer::set_occlusion(const bool occlusion) {
+    this->occlusion = occlusion;
+}
+
+bool ParticleRenderer::get_occlusion() {
+    return this->occlusion;
+}
+
+void ParticleRenderer::set_quantized(const bool quantized) {
+    this->quantized = quantized;
+}
+
+bool ParticleRenderer::get_quantized() {
+    return this->quantized;
+}
+
+void ParticleRenderer::set_splatting(const bool splatting) {
+    this->splatting = splatting;
+}
+
+bool ParticleRenderer::get_splatting() {
+    return this->splatting;
+}
+
+void ParticleRenderer::set_splat_gaussian(const bool gaussian) {
+    this->splat_gaussian = gaussian;
+}
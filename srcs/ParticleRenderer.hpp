@@ -0,0 +1,134 @@
+#ifndef PARTICLERENDERER_HPP
+#define PARTICLERENDERER_HPP
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <array>
+#include <vector>
+
+#include "CameraBuffer.hpp"
+#include "ParticleColor.hpp"
+#include "ParticleCulling.hpp"
+#include "Shader.hpp"
+
+
+// Levels of detail, from the closest particles to the farthest
+enum ParticleLod {
+    LOD_MESH,
+    LOD_LOW_POLY,
+    LOD_IMPOSTOR,
+    LOD_POINT,
+    LOD_NUM
+};
+
+struct InstancedMesh {
+    unsigned int VAO;
+    unsigned int VBO;
+    int vertex_num;
+    GLenum mode;
+};
+
+
+// Draws the particles as instances. With culling, only the particles of chunks inside the view frustum
+// are uploaded, and with occlusion culling only those not hidden behind the depth buffer of the previous
+// frame, which is read back asynchronously. With level of detail, every frame the particles are bucketed
+// by their projected radius on screen into a sphere mesh, a low-poly sphere, a ray-cast impostor or a
+// single pixel, and each bucket is drawn with one instanced draw call. Otherwise all of them are drawn
+// as impostors or as the full mesh. The color of a particle comes from its shade, a palette index and a
+// gradient position of one byte each, and the palettes in a uniform block shared by the particle shaders.
+// With quantized positions, each position is sent as 16-bit fixed point relative to the bounds of its
+// chunk, which the shaders read from a buffer texture. That saves a third of the position upload but
+// costs more CPU time than gathering the floats, so it only pays off when the upload is the bottleneck
+// and is off by default. With splatting, depth testing and level of
+// detail are skipped: every visible particle adds its color and density to a floating-point buffer,
+// which is then tone mapped onto the screen.
+class ParticleRenderer {
+    private:
+        Shader mesh_shader;
+        Shader impostor_shader;
+        Shader splat_shader;
+        Shader splat_tonemap_shader;
+        std::array<InstancedMesh, LOD_NUM> meshes;
+        unsigned int position_VBO;
+        unsigned int shade_VBO;
+        unsigned int palette_UBO;
+        unsigned int radius_VBO;
+        unsigned int depth_PBO;
+        unsigned int quantized_VBO;
+        unsigned int chunk_bounds_TBO;
+        unsigned int chunk_bounds_texture;
+        unsigned int splat_FBO;
+        unsigned int splat_texture;
+        unsigned int empty_VAO;
+        ParticleCulling particle_culling;
+        int viewport_width;
+        int viewport_height;
+        bool impostors;
+        bool lod;
+        bool culling;
+        bool occlusion;
+        bool quantized;
+        bool splatting;
+        bool splat_gaussian;
+        float splat_exposure;
+        float splat_white_density;
+        bool depth_pending;
+        glm::mat4 depth_view_projection;
+
+        // Instances of the current frame, owned by the caller of upload, the visible ones, and those sorted
+        // by bucket for drawing
+        const std::vector<glm::vec3> *position;
+        const std::vector<glm::u8vec2> *shade;
+        const std::vector<float> *radius;
+        std::vector<int> visible;
+        std::vector<int> sorted_particle;
+        std::vector<glm::vec3> sorted_position;
+        std::vector<glm::u16vec4> sorted_quantized;
+        std::vector<glm::vec4> chunk_bounds;
+        std::vector<glm::u8vec2> sorted_shade;
+        std::vector<float> sorted_radius;
+        std::array<int, LOD_NUM + 1> bucket_offset;
+
+        void create_mesh(InstancedMesh &mesh, const std::vector<float> &vertices, const int components,
+                         const GLenum mode);
+        void set_instance_attributes(const int first_instance);
+        int select_lod(const glm::vec3 &position, const float radius, const glm::mat4 &view,
+                       const glm::mat4 &projection);
+        void read_depth();
+        void request_depth(const glm::mat4 &view_projection);
+        void upload_instances();
+        void find_visible(const glm::mat4 &view, const glm::mat4 &projection);
+        void sort_by_lod(const glm::mat4 &view, const glm::mat4 &projection);
+        void resize_splat_target();
+        void draw_splats();
+        void draw_bucket(const int lod, const int first_instance, const int instance_num);
+
+    public:
+        ParticleRenderer(const std::vector<float> &mesh_vertices, const std::vector<float> &low_poly_vertices,
+                         const int viewport_width, const int viewport_height);
+        ~ParticleRenderer();
+
+        void upload(const std::vector<glm::vec3> &position, const std::vector<glm::u8vec2> &shade,
+                    const std::vector<float> &radius);
+        void set_palette(const std::vector<glm::vec3> &stops);
+        void draw(const glm::mat4 &view, const glm::mat4 &projection);
+        void set_viewport(const int width, const int height);
+        void set_impostors(const bool impostors);
+        bool get_impostors();
+        void set_lod(const bool lod);
+        bool get_lod();
+        void set_culling(const bool culling);
+        bool get_culling();
+        void set_occlusion(const bool occlusion);
+        bool get_occlusion();
+        void set_quantized(const bool quantized);
+        bool get_quantized();
+        void set_splatting(const bool splatting);
+        bool get_splatting();
+        void set_splat_gaussian(const bool gaussian);
+};
+
+#endif
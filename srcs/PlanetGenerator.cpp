@@ -0,0 +1,184 @@
+#include "PlanetGenerator.hpp"
+
+
+const float PI = 3.14159265359f;
+
+// Particles closer than this many radii apart are in contact
+const float MIN_SPACING = 2.0f * 1.001f;
+// Random sequential adsorption jams at a volume fraction of about 0.38; stay well below it
+const float POISSON_DISK_FRACTION = 0.2f;
+const int POISSON_DISK_ATTEMPTS = 50;
+
+PlanetGenerator::PlanetGenerator() {
+    this->packing = InitialPacking::RANDOM;
+    this->packing_seed = 0;
+}
+
+PlanetGenerator::~PlanetGenerator() {
+}
+
+void PlanetGenerator::initialize(const SimulationConfig &config) {
+    this->packing = config.initial_packing;
+    this->cache_dir = config.packing_cache_dir;
+    this->packing_seed = config.seed;
+}
+
+bool PlanetGenerator::generate(const float planet_radius, const int particle_num, const float particle_radius,
+    const int planet, std::vector<glm::vec3> &offset) {
+    // Fills offset with particle positions relative to the planet center, from the cache if this planet
+    // was generated before. Returns false for RANDOM packing, which is sampled per particle instead, and
+    // when dart throwing fails, so that the caller falls back to it.
+    // Packings are keyed on config.seed rather than the seed of the run, so that runs with a random seed
+    // share the cached packings instead of adding a new file every time.
+    if (this->packing == InitialPacking::RANDOM) {
+        return false;
+    }
+    unsigned long long seed = this->packing_seed + planet;
+
+    std::string path = cache_path(planet_radius, particle_num, particle_radius, seed);
+    if (load(path, particle_num, offset)) {
+        return true;
+    }
+    if (this->packing == InitialPacking::HCP) {
+        generate_hcp(planet_radius, particle_num, particle_radius, offset);
+    } else if (!generate_poisson_disk(planet_radius, particle_num, particle_radius, seed, offset)) {
+        offset.clear();
+        return false;
+    }
+    save(path, offset);
+    return true;
+}
+
+std::string PlanetGenerator::cache_path(const float planet_radius, const int particle_num,
+    const float particle_radius, const unsigned long long seed) {
+    // The lattice doesn't depend on the seed
+    std::string name = this->packing == InitialPacking::HCP ? "hcp" : "poisson_disk_" + std::to_string(seed);
+    name += "_" + std::to_string(particle_num) + "_" + std::to_string(planet_radius) + "_"
+        + std::to_string(particle_radius) + ".bin";
+    return (std::filesystem::path(this->cache_dir) / name).string();
+}
+
+bool PlanetGenerator::load(const std::string &path, const int particle_num, std::vector<glm::vec3> &offset) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    int count = 0;
+    file.read(reinterpret_cast<char *>(&count), sizeof(int));
+    if (!file || count != particle_num) {
+        return false;
+    }
+    offset.resize(count);
+    file.read(reinterpret_cast<char *>(offset.data()), count * sizeof(glm::vec3));
+    return bool(file);
+}
+
+void PlanetGenerator::save(const std::string &path, const std::vector<glm::vec3> &offset) {
+    // The cache is only an optimization, so failing to write it is not an error
+    std::error_code error;
+    std::filesystem::create_directories(this->cache_dir, error);
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        std::cout << "Could not write the planet cache " << path << std::endl;
+        return;
+    }
+    int count = offset.size();
+    file.write(reinterpret_cast<const char *>(&count), sizeof(int));
+    file.write(reinterpret_cast<const char *>(offset.data()), count * sizeof(glm::vec3));
+}
+
+void PlanetGenerator::generate_hcp(const float planet_radius, const int particle_num, const float particle_radius,
+    std::vector<glm::vec3> &offset) {
+    // The lattice spacing is chosen so that particle_num sites fill the planet volume. The number density
+    // of a hexagonal close-packed lattice with spacing a is sqrt(2) / a^3.
+    float volume = 4.0f / 3.0f * PI * planet_radius * planet_radius * planet_radius;
+    float spacing = std::cbrt(std::sqrt(2.0f) * volume / particle_num);
+    if (spacing < MIN_SPACING * particle_radius) {
+        spacing = MIN_SPACING * particle_radius;
+        float radius = std::cbrt(particle_num * spacing * spacing * spacing / std::sqrt(2.0f) * 3.0f / (4.0f * PI));
+        std::cout << "The particles don't fit into a planet of radius " << planet_radius
+                  << " without overlapping; its radius grows to about " << radius << std::endl;
+    }
+
+    // Sites of a cube large enough to hold the sphere, then the particle_num sites closest to the center
+    float layer_height = spacing * std::sqrt(2.0f / 3.0f);
+    float row_height = spacing * std::sqrt(3.0f) / 2.0f;
+    float half_size = std::cbrt(particle_num * spacing * spacing * spacing / std::sqrt(2.0f)) * 0.75f + 2.0f * spacing;
+    int layer_num = int(half_size / layer_height) + 1;
+    int row_num = int(half_size / row_height) + 1;
+    int column_num = int(half_size / spacing) + 1;
+    std::vector<glm::vec3> site;
+    for (int k = -layer_num; k <= layer_num; k++) {
+        // ABAB stacking: every other layer is shifted into the hollows of the one below
+        bool shifted = (k & 1) != 0;
+        for (int j = -row_num; j <= row_num; j++) {
+            for (int i = -column_num; i <= column_num; i++) {
+                glm::vec3 pos;
+                pos.x = spacing * (i + 0.5f * (j & 1)) + (shifted ? 0.5f * spacing : 0.0f);
+                pos.y = k * layer_height;
+                pos.z = j * row_height + (shifted ? row_height / 3.0f : 0.0f);
+                site.push_back(pos);
+            }
+        }
+    }
+    std::nth_element(site.begin(), site.begin() + particle_num - 1, site.end(),
+        [](const glm::vec3 &a, const glm::vec3 &b) { return glm::dot(a, a) < glm::dot(b, b); });
+    offset.assign(site.begin(), site.begin() + particle_num);
+}
+
+bool PlanetGenerator::generate_poisson_disk(const float planet_radius, const int particle_num,
+    const float particle_radius, const unsigned long long seed, std::vector<glm::vec3> &offset) {
+    // Dart throwing with a minimum distance between particles. A uniform grid with cells of the minimum
+    // distance holds the accepted particles, so each dart only checks the 27 surrounding cells.
+    float particle_volume = 4.0f / 3.0f * PI * particle_radius * particle_radius * particle_radius;
+    float radius = std::max(planet_radius,
+        std::cbrt(particle_num * particle_volume / POISSON_DISK_FRACTION * 3.0f / (4.0f * PI)));
+    if (radius > planet_radius) {
+        std::cout << "The particles don't fit into a planet of radius " << planet_radius
+                  << " by dart throwing; its radius grows to " << radius << std::endl;
+    }
+    float volume = 4.0f / 3.0f * PI * radius * radius * radius;
+    float min_distance = std::max(MIN_SPACING * particle_radius, 0.7f * std::cbrt(std::sqrt(2.0f) * volume / particle_num));
+
+    float cell_size = min_distance;
+    int dim = int(std::ceil(2.0f * radius / cell_size)) + 1;
+    std::vector<int> cell(dim * dim * dim, -1);
+    std::vector<int> next_in_cell;
+    CounterRng rng(seed);
+    offset.clear();
+    long long max_attempts = (long long)POISSON_DISK_ATTEMPTS * particle_num;
+    for (long long attempt = 0; attempt < max_attempts && int(offset.size()) < particle_num; attempt++) {
+        std::array<uint32_t, 4> random = rng.generate(uint32_t(attempt), uint32_t(attempt >> 32), 0, 0);
+        glm::vec3 pos = radius * (2.0f * glm::vec3(CounterRng::to_unit_float(random[0]),
+            CounterRng::to_unit_float(random[1]), CounterRng::to_unit_float(random[2])) - 1.0f);
+        if (glm::length(pos) > radius - particle_radius) {
+            continue;
+        }
+
+        glm::ivec3 coord = glm::clamp(glm::ivec3((pos + radius) / cell_size), 0, dim - 1);
+        bool too_close = false;
+        for (int z = std::max(coord.z - 1, 0); z <= std::min(coord.z + 1, dim - 1) && !too_close; z++) {
+            for (int y = std::max(coord.y - 1, 0); y <= std::min(coord.y + 1, dim - 1) && !too_close; y++) {
+                for (int x = std::max(coord.x - 1, 0); x <= std::min(coord.x + 1, dim - 1) && !too_close; x++) {
+                    for (int k = cell[(z * dim + y) * dim + x]; k >= 0 && !too_close; k = next_in_cell[k]) {
+                        too_close = glm::distance(pos, offset[k]) < min_distance;
+                    }
+                }
+            }
+        }
+        if (too_close) {
+            continue;
+        }
+        int index = (coord.z * dim + coord.y) * dim + coord.x;
+        next_in_cell.push_back(cell[index]);
+        cell[index] = offset.size();
+        offset.push_back(pos);
+    }
+
+    if (int(offset.size()) < particle_num) {
+        std::cerr << "Dart throwing placed only " << offset.size() << " of " << particle_num
+                  << " particles; falling back to random packing" << std::endl;
+        return false;
+    }
+    return true;
+}
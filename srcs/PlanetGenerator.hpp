@@ -0,0 +1,41 @@
+#ifndef PLANETGENERATOR_HPP
+#define PLANETGENERATOR_HPP
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "CounterRng.hpp"
+#include "SimulationConfig.hpp"
+
+
+class PlanetGenerator {
+    private:
+        InitialPacking packing;
+        std::string cache_dir;
+        unsigned long long packing_seed;
+
+        std::string cache_path(const float planet_radius, const int particle_num, const float particle_radius,
+                               const unsigned long long seed);
+        bool load(const std::string &path, const int particle_num, std::vector<glm::vec3> &offset);
+        void save(const std::string &path, const std::vector<glm::vec3> &offset);
+        void generate_hcp(const float planet_radius, const int particle_num, const float particle_radius,
+                          std::vector<glm::vec3> &offset);
+        bool generate_poisson_disk(const float planet_radius, const int particle_num, const float particle_radius,
+                                   const unsigned long long seed, std::vector<glm::vec3> &offset);
+
+    public:
+        PlanetGenerator();
+        ~PlanetGenerator();
+
+        void initialize(const SimulationConfig &config);
+        bool generate(const float planet_radius, const int particle_num, const float particle_radius,
+                      const int planet, std::vector<glm::vec3> &offset);
+};
+
+#endif
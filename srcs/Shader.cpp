@@ -1,6 +1,36 @@
 #include "Shader.hpp"
 
-Shader::Shader(const char *vertexPath, const char *fragmentPath) {
+// Program binaries need GL 4.1, beyond what the loader provides, so their entry points are loaded by
+// enableBinaryCache. The cache stays off when they are missing.
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+typedef void (APIENTRYP GetProgramBinaryProc)(GLuint program, GLsizei bufSize, GLsizei *length,
+                                              GLenum *binaryFormat, void *binary);
+typedef void (APIENTRYP ProgramBinaryProc)(GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+typedef void (APIENTRYP ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+
+static GetProgramBinaryProc getProgramBinary = NULL;
+static ProgramBinaryProc programBinary = NULL;
+static ProgramParameteriProc programParameteri = NULL;
+static std::string binaryCacheDir;
+
+void Shader::enableBinaryCache(GLADloadproc load, const std::string &directory) {
+    getProgramBinary = (GetProgramBinaryProc)load("glGetProgramBinary");
+    programBinary = (ProgramBinaryProc)load("glProgramBinary");
+    programParameteri = (ProgramParameteriProc)load("glProgramParameteri");
+    int formatNum = 0;
+    if (getProgramBinary && programBinary && programParameteri) {
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatNum);
+    }
+    if (formatNum <= 0) {
+        std::cout << "Program binaries are not supported; shaders are compiled on every start" << std::endl;
+        return;
+    }
+    binaryCacheDir = directory;
+}
+
+Shader::Shader(const char *vertexPath, const char *fragmentPath, const char *vertexHeaderPath) {
     // 1. Retrieve the vertex/fragment source code from filePath
     std::string vertexCode;
     std::string fragmentCode;
@@ -23,12 +53,33 @@ Shader::Shader(const char *vertexPath, const char *fragmentPath) {
         // Convert stream into string
         vertexCode = vShaderStream.str();
         fragmentCode = fShaderStream.str();
-    } catch (std::ifstream::failure e) {
+        if (vertexHeaderPath) {
+            std::ifstream hShaderFile;
+            hShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+            hShaderFile.open(vertexHeaderPath);
+            std::stringstream hShaderStream;
+            hShaderStream << hShaderFile.rdbuf();
+            hShaderFile.close();
+            // #version has to stay first; #line keeps the compile errors on the lines of the vertex file
+            size_t bodyStart = vertexCode.find('\n') + 1;
+            vertexCode.insert(bodyStart, hShaderStream.str() + "\n#line 2\n");
+        }
+    } catch (const std::ifstream::failure &e) {
         std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
     }
     const char *vShaderCode = vertexCode.c_str();
     const char *fShaderCode = fragmentCode.c_str();
 
+    // Reuse the program binary of an earlier run if the sources and the driver are unchanged
+    std::string binaryPath;
+    if (!binaryCacheDir.empty()) {
+        binaryPath = binaryCachePath(vertexCode, fragmentCode);
+        if (loadBinary(binaryPath)) {
+            cacheUniformLocations();
+            return;
+        }
+    }
+
     // 2. Compile shaders
     unsigned int vertex, fragment;
     int success;
@@ -57,41 +108,157 @@ Shader::Shader(const char *vertexPath, const char *fragmentPath) {
     ID = glCreateProgram();
     glAttachShader(ID, vertex);
     glAttachShader(ID, fragment);
+    if (!binaryPath.empty()) {
+        programParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
     glLinkProgram(ID);
     // Print linking errors if any
     glGetProgramiv(ID, GL_LINK_STATUS, &success);
     if (!success) {
         glGetProgramInfoLog(ID, 512, NULL, infoLog);
         std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+    } else if (!binaryPath.empty()) {
+        saveBinary(binaryPath);
     }
 
     // Delete shaders; they're linked into our program and no longer necessary
     glDeleteShader(vertex);
     glDeleteShader(fragment);
+    cacheUniformLocations();
+}
+
+std::string Shader::binaryCachePath(const std::string &vertexCode, const std::string &fragmentCode) {
+    // FNV-1a hash of both sources and the driver identity; a new driver compiles differently
+    std::string key = vertexCode + '\0' + fragmentCode + '\0';
+    for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+        const char *value = (const char *)glGetString(name);
+        key += std::string(value ? value : "") + '\0';
+    }
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : key) {
+        hash = (hash ^ c) * 1099511628211ULL;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)hash);
+    return (std::filesystem::path(binaryCacheDir) / name).string();
+}
+
+bool Shader::loadBinary(const std::string &path) {
+    // File layout: binary format, length, then the binary itself
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    GLenum format = 0;
+    int length = 0;
+    file.read(reinterpret_cast<char *>(&format), sizeof(GLenum));
+    file.read(reinterpret_cast<char *>(&length), sizeof(int));
+    if (!file || length <= 0) {
+        return false;
+    }
+    std::vector<char> binary(length);
+    file.read(binary.data(), length);
+    if (!file) {
+        return false;
+    }
+
+    // The driver may still reject a binary it wrote, then the sources are compiled again
+    ID = glCreateProgram();
+    programBinary(ID, format, binary.data(), length);
+    int success;
+    glGetProgramiv(ID, GL_LINK_STATUS, &success);
+    if (!success) {
+        glDeleteProgram(ID);
+        return false;
+    }
+    return true;
+}
+
+void Shader::saveBinary(const std::string &path) {
+    // The cache is only an optimization, so failing to write it is not an error
+    int length = 0;
+    glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+        return;
+    }
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    getProgramBinary(ID, length, &length, &format, binary.data());
+
+    std::error_code error;
+    std::filesystem::create_directories(binaryCacheDir, error);
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        std::cout << "Could not write the program binary cache " << path << std::endl;
+        return;
+    }
+    file.write(reinterpret_cast<const char *>(&format), sizeof(GLenum));
+    file.write(reinterpret_cast<const char *>(&length), sizeof(int));
+    file.write(binary.data(), length);
+}
+
+void Shader::cacheUniformLocations() {
+    // Uniforms in blocks have no location and are skipped. Arrays are reported as "name[0]", so they are
+    // also stored under their bare name.
+    int count = 0;
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+    char name[256];
+    for (int i = 0; i < count; i++) {
+        int length = 0;
+        int size = 0;
+        GLenum type;
+        glGetActiveUniform(ID, i, sizeof(name), &length, &size, &type, name);
+        int location = glGetUniformLocation(ID, name);
+        if (location < 0) {
+            continue;
+        }
+        std::string uniform(name, length);
+        uniformLocations[uniform] = location;
+        if (uniform.size() > 3 && uniform.compare(uniform.size() - 3, 3, "[0]") == 0) {
+            uniformLocations[uniform.substr(0, uniform.size() - 3)] = location;
+        }
+    }
 }
 
 void Shader::use() { glUseProgram(ID); }
 
+int Shader::getUniformLocation(const std::string &name) const {
+    // -1 for uniforms the program doesn't use, which glUniform ignores
+    std::unordered_map<std::string, int>::const_iterator it = uniformLocations.find(name);
+    return it == uniformLocations.end() ? -1 : it->second;
+}
+
+void Shader::bindUniformBlock(const std::string &name, unsigned int binding) const {
+    unsigned int index = glGetUniformBlockIndex(ID, name.c_str());
+    if (index != GL_INVALID_INDEX) {
+        glUniformBlockBinding(ID, index, binding);
+    }
+}
+
 void Shader::setBool(const std::string &name, bool value) const {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+    glUniform1i(getUniformLocation(name), (int)value);
 }
 
 void Shader::setInt(const std::string &name, int value) const {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+    glUniform1i(getUniformLocation(name), value);
 }
 
 void Shader::setFloat(const std::string &name, float value) const {
-    glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+    glUniform1f(getUniformLocation(name), value);
 }
 
 void Shader::setVec2(const std::string &name, const glm::vec2 &value) const {
-    glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+    glUniform2fv(getUniformLocation(name), 1, &value[0]);
 }
 
 void Shader::setVec3(const std::string &name, float x, float y, float z) const {
-    glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+    glUniform3f(getUniformLocation(name), x, y, z);
 }
 
 void Shader::setVec3fv(const std::string &name, const glm::vec3 &value) const {
-    glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+    glUniform3fv(getUniformLocation(name), 1, &value[0]);
+}
+
+void Shader::setMat4(const std::string &name, const glm::mat4 &value) const {
+    glUniformMatrix4fv(getUniformLocation(name), 1, GL_FALSE, &value[0][0]);
 }
@@ -6,24 +6,44 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
 #include <string>
+#include <vector>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
 
 
 class Shader {
+    private:
+        // Locations of the active uniforms, looked up once after linking
+        std::unordered_map<std::string, int> uniformLocations;
+
+        void cacheUniformLocations();
+        std::string binaryCachePath(const std::string &vertexCode, const std::string &fragmentCode);
+        bool loadBinary(const std::string &path);
+        void saveBinary(const std::string &path);
+
     public:
         unsigned int ID;
 
-        Shader(const char* vertexPath, const char* fragmentPath);
+        // The optional header holds declarations shared by several vertex shaders and is inserted after their
+        // #version line
+        Shader(const char* vertexPath, const char* fragmentPath, const char* vertexHeaderPath = NULL);
+        static void enableBinaryCache(GLADloadproc load, const std::string &directory);
         void use();
+        int getUniformLocation(const std::string &name) const;
+        void bindUniformBlock(const std::string &name, unsigned int binding) const;
         void setBool(const std::string &name, bool value) const;
         void setInt(const std::string &name, int value) const;
         void setFloat(const std::string &name, float value) const;
         void setVec2(const std::string &name, const glm::vec2 &value) const;
         void setVec3(const std::string &name, float x, float y, float z) const;
         void setVec3fv(const std::string &name, const glm::vec3 &value) const;
+        void setMat4(const std::string &name, const glm::mat4 &value) const;
 };
 
 #endif
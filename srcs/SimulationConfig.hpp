@@ -0,0 +1,84 @@
+#ifndef SIMULATIONCONFIG_HPP
+#define SIMULATIONCONFIG_HPP
+
+#include <string>
+
+#define GRAVITATIONAL_CONSTANT 6.67430e-11f
+
+// How particles are placed inside a planet. RANDOM samples spherical coordinates uniformly, which is
+// denser toward the center and overlaps. HCP carves a sphere out of a hexagonal close-packed lattice and
+// POISSON_DISK throws darts with a minimum distance; both have uniform density and no overlaps.
+enum class InitialPacking {
+    RANDOM,
+    HCP,
+    POISSON_DISK
+};
+
+
+struct SimulationConfig {
+    // Extra margin added to the collision distance when building Verlet neighbor lists.
+    // The lists are rebuilt once any particle has moved more than half of this value.
+    float neighbor_skin = 0.02f;
+    // Sweep the spheres over the whole step and resolve contacts at their time of impact,
+    // so that fast particles don't tunnel through each other with large time steps.
+    bool continuous_collision = false;
+    // Number of contact substeps per gravity evaluation (r-RESPA). Collisions are resolved on the
+    // inner step of length delta_time / respa_inner_steps, gravity as half kicks on the outer step.
+    int respa_inner_steps = 1;
+    // Coefficient of restitution of the contact response (1 is perfectly elastic). Touching pairs
+    // with a relative speed below accretion_speed merge into one particle (0 disables accretion).
+    float restitution = 1.0f;
+    float accretion_speed = 0.0f;
+    // Move the particles from collision to collision with an event-driven hard-sphere solver between
+    // gravity kicks. It is either always on, or switched on while the number of touching pairs per
+    // particle and step exceeds event_driven_contact_ratio (0 disables the switch). The ratio has to stay
+    // above that of the resting planets, or the solver runs in a packed state, hits its event limit and
+    // falls back to time stepping every other step.
+    bool event_driven = false;
+    float event_driven_contact_ratio = 0.0f;
+    int event_driven_max_cells = 128;
+    // Every coarsening_interval steps (0 disables), settled groups of at least coarsening_min_members
+    // particles in a cell of coarsening_cell_size are replaced by one super-particle with the same mass
+    // and momentum. A group is settled if its velocity dispersion is below coarsening_max_dispersion,
+    // none of its members took a contact impulse above coarsening_split_impulse since the last pass, and,
+    // with coarsening_require_bound, it is gravitationally bound. Super-particles that take such an
+    // impulse are split back into their members.
+    int coarsening_interval = 0;
+    float coarsening_cell_size = 0.1f;
+    int coarsening_min_members = 8;
+    float coarsening_max_dispersion = 0.01f;
+    float coarsening_split_impulse = 0.05f;
+    bool coarsening_require_bound = true;
+    // Particles without contacts whose gravity changed by less than sleep_acceleration and whose speed
+    // relative to each neighbor stayed below sleep_speed for sleep_steps consecutive steps fall asleep
+    // (0 disables sleeping): they drift with their last acceleration and skip gravity and contact
+    // evaluation. They wake up when they are about to touch any other particle, or when the full gravity
+    // evaluation done every sleep_check_interval steps shows that their force changed.
+    int sleep_steps = 0;
+    float sleep_speed = 1e-3f;
+    float sleep_acceleration = 1e-4f;
+    int sleep_check_interval = 10;
+    // Every escape_check_interval steps (0 disables), particles farther than escape_distance from the
+    // center of mass that move away from it with positive energy leave the simulation. With escape_retire
+    // they keep flying in a straight line on the host and are still drawn, otherwise they are dropped.
+    int escape_check_interval = 0;
+    float escape_distance = 10.0f;
+    bool escape_retire = true;
+    // Removed particles leave tombstones whose slots are reused by new particles. The arrays are
+    // compacted once the tombstones exceed this fraction of all slots.
+    float tombstone_ratio = 0.05f;
+    // Makes two runs with the same seed agree bit for bit, independently of the number of threads:
+    // the initial conditions are drawn from seed, every step advances by fixed_delta_time instead of
+    // the frame time, and sums over particles are done in a fixed pairwise order.
+    bool deterministic = false;
+    unsigned long long seed = 0;
+    float fixed_delta_time = 0.01f;
+    // Packing of the initial planets. Generated packings are cached in packing_cache_dir, relative to the
+    // working directory unless absolute, and reused by later runs with the same parameters. If dart
+    // throwing can't place every particle, the planet falls back to RANDOM. POISSON_DISK packings are always drawn from seed, also outside
+    // of deterministic mode, so that the cache doesn't grow with every run.
+    InitialPacking initial_packing = InitialPacking::RANDOM;
+    std::string packing_cache_dir = "../cache";
+};
+
+#endif
@@ -0,0 +1,159 @@
+#include "TextureLoader.hpp"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+
+// Identifies a decoded image cache file and its layout version
+const char CACHE_MAGIC[8] = {'I', 'X', 'R', 'A', 'W', '0', '0', '1'};
+
+struct CacheHeader {
+    char magic[8];
+    // Size and modification time of the image file the pixels were decoded from
+    uint64_t source_size;
+    int64_t source_time;
+    int32_t width;
+    int32_t height;
+    int32_t channels;
+};
+
+TextureLoader::TextureLoader() {
+}
+
+TextureLoader::~TextureLoader() {
+}
+
+static bool source_stamp(const std::string &path, uint64_t &size, int64_t &time) {
+    std::error_code error;
+    size = std::filesystem::file_size(path, error);
+    if (error) {
+        return false;
+    }
+    time = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+    return !error;
+}
+
+bool TextureLoader::load_cache(const std::string &path, DecodedImage &image) {
+    // A cache is only valid for the exact file it was decoded from
+    uint64_t size;
+    int64_t time;
+    if (!source_stamp(path, size, time)) {
+        return false;
+    }
+    std::ifstream file(path + ".raw", std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    CacheHeader header;
+    file.read(reinterpret_cast<char *>(&header), sizeof(CacheHeader));
+    if (!file || std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header.source_size != size
+        || header.source_time != time) {
+        return false;
+    }
+    image.width = header.width;
+    image.height = header.height;
+    image.channels = header.channels;
+    image.pixels.resize(size_t(image.width) * image.height * image.channels);
+    file.read(reinterpret_cast<char *>(image.pixels.data()), image.pixels.size());
+    return bool(file);
+}
+
+void TextureLoader::save_cache(const std::string &path, const DecodedImage &image) {
+    // The cache is only an optimization, so failing to write it is not an error
+    CacheHeader header;
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    if (!source_stamp(path, header.source_size, header.source_time)) {
+        return;
+    }
+    header.width = image.width;
+    header.height = image.height;
+    header.channels = image.channels;
+    std::ofstream file(path + ".raw", std::ios::binary);
+    if (!file) {
+        std::cout << "Could not write the texture cache " << path << ".raw" << std::endl;
+        return;
+    }
+    file.write(reinterpret_cast<const char *>(&header), sizeof(CacheHeader));
+    file.write(reinterpret_cast<const char *>(image.pixels.data()), image.pixels.size());
+}
+
+bool TextureLoader::decode(const std::string &path, DecodedImage &image) {
+    if (load_cache(path, image)) {
+        return true;
+    }
+    unsigned char *data = stbi_load(path.c_str(), &image.width, &image.height, &image.channels, 0);
+    if (!data) {
+        return false;
+    }
+    image.pixels.assign(data, data + size_t(image.width) * image.height * image.channels);
+    stbi_image_free(data);
+    save_cache(path, image);
+    return true;
+}
+
+void TextureLoader::decode_all(const std::vector<std::string> &paths, std::vector<DecodedImage> &images,
+    std::vector<char> &loaded) {
+    // One worker per image; stbi_load keeps no shared state between calls
+    images.assign(paths.size(), DecodedImage());
+    loaded.assign(paths.size(), 0);
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < paths.size(); i++) {
+        workers.push_back(std::thread([&, i]() {
+            loaded[i] = decode(paths[i], images[i]);
+        }));
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+}
+
+unsigned int TextureLoader::load_cubemap(const std::vector<std::string> &faces) {
+    std::vector<DecodedImage> images;
+    std::vector<char> loaded;
+    decode_all(faces, images, loaded);
+
+    // All faces go into one pixel buffer, and each glTexImage2D reads its face from an offset in it
+    std::vector<size_t> offset(faces.size(), 0);
+    size_t total_size = 0;
+    for (size_t i = 0; i < faces.size(); i++) {
+        offset[i] = total_size;
+        total_size += images[i].pixels.size();
+    }
+    unsigned int PBO;
+    glGenBuffers(1, &PBO);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, PBO);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, total_size, NULL, GL_STREAM_DRAW);
+    if (total_size > 0) {
+        unsigned char *mapped = (unsigned char *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, total_size,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        for (size_t i = 0; i < faces.size(); i++) {
+            std::memcpy(mapped + offset[i], images[i].pixels.data(), images[i].pixels.size());
+        }
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+
+    unsigned int texture_ID;
+    glGenTextures(1, &texture_ID);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, texture_ID);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (unsigned int i = 0; i < faces.size(); i++) {
+        if (!loaded[i]) {
+            std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
+            continue;
+        }
+        GLenum format = images[i].channels == 4 ? GL_RGBA : (images[i].channels == 1 ? GL_RED : GL_RGB);
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, images[i].width, images[i].height, 0, format,
+            GL_UNSIGNED_BYTE, (void*)offset[i]);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(1, &PBO);
+
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+    return texture_ID;
+}
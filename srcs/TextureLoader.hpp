@@ -0,0 +1,41 @@
+#ifndef TEXTURELOADER_HPP
+#define TEXTURELOADER_HPP
+
+#include <glad/glad.h>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+struct DecodedImage {
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    std::vector<unsigned char> pixels;
+};
+
+
+// Loads textures with the image files decoded in parallel on worker threads and the pixels uploaded
+// through a pixel buffer object. Each decoded image is stored next to its file with the extension .raw,
+// so later starts read the pixels directly instead of decoding the PNG again.
+class TextureLoader {
+    private:
+        bool decode(const std::string &path, DecodedImage &image);
+        bool load_cache(const std::string &path, DecodedImage &image);
+        void save_cache(const std::string &path, const DecodedImage &image);
+        void decode_all(const std::vector<std::string> &paths, std::vector<DecodedImage> &images,
+                        std::vector<char> &loaded);
+
+    public:
+        TextureLoader();
+        ~TextureLoader();
+
+        unsigned int load_cubemap(const std::vector<std::string> &faces);
+};
+
+#endif
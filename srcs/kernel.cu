@@ -1,32 +1,414 @@
 #include "kernel.cuh"
 
 
-__global__ void update_particle_kernel(glm::vec3 *cu_position, glm::vec3 *cu_velocity, const float mass,
-    const float delta_time, const int num_particles, const float collision_distance) {
+__global__ void compute_gravity_kernel(const glm::vec3 *cu_position, const float *cu_mass, const float *cu_radius,
+    glm::vec3 *cu_acceleration, const int *cu_asleep, const bool include_asleep, const int num_particles) {
     int i = blockIdx.x * blockDim.x + threadIdx.x;
     if (i >= num_particles) {
         return;
     }
+    // Sleeping particles keep their last acceleration
+    if (cu_asleep[i] && !include_asleep) {
+        return;
+    }
+    // Tombstones neither attract nor get attracted
+    if (cu_mass[i] <= 0.0f) {
+        cu_acceleration[i] = glm::vec3(0.0f);
+        return;
+    }
 
     glm::vec3 all_accel(0.0f);
     for (int j = 0; j < num_particles; j++) {
-        if (i == j) {
+        if (i == j || cu_mass[j] <= 0.0f) {
             continue;
         }
         float dist = glm::distance(cu_position[i], cu_position[j]);
-        if (dist <= collision_distance) {
-            // Calculate collision
-            cu_velocity[i] = cu_velocity[i] - (glm::dot(
-                cu_velocity[i] - cu_velocity[j], cu_position[i] - cu_position[j]) / (dist * dist))
-                * (cu_position[i] - cu_position[j]);
-        } else {
-            // Calculate gravity
-            float G = 6.67430e-11;
-            float accel_power = G * (mass * mass) / (dist * dist);
+        if (dist > cu_radius[i] + cu_radius[j]) {
+            float accel_power = GRAVITATIONAL_CONSTANT * cu_mass[j] / (dist * dist);
             glm::vec3 accel = (cu_position[j] - cu_position[i]) / dist * accel_power;
             all_accel += accel;
         }
     }
-    cu_velocity[i] += all_accel * delta_time;
-    cu_position[i] += cu_velocity[i] * delta_time;
+    cu_acceleration[i] = all_accel;
+}
+
+__device__ float contact_time(const glm::vec3 &relative_position, const glm::vec3 &relative_velocity,
+    const float collision_distance, const float sweep_time) {
+    // Earliest t in [0, sweep_time] with |relative_position + relative_velocity * t| <= collision_distance,
+    // or a negative value if the spheres don't touch during the sweep
+    float c = glm::dot(relative_position, relative_position) - collision_distance * collision_distance;
+    if (c <= 0.0f) {
+        return 0.0f;
+    }
+    float b = glm::dot(relative_position, relative_velocity);
+    float a = glm::dot(relative_velocity, relative_velocity);
+    if (b >= 0.0f || a <= 0.0f) {
+        return -1.0f;
+    }
+    float discriminant = b * b - a * c;
+    if (discriminant < 0.0f) {
+        return -1.0f;
+    }
+    float t = (-b - sqrtf(discriminant)) / a;
+    return t <= sweep_time ? t : -1.0f;
+}
+
+__global__ void wake_touched_kernel(const glm::vec3 *cu_position, const glm::vec3 *cu_velocity,
+    const float *cu_radius, const int *cu_neighbor_offset, const int *cu_neighbor_index, int *cu_asleep,
+    int *cu_sleep_counter, const int num_particles, const float sweep_time) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= num_particles || !cu_asleep[i]) {
+        return;
+    }
+
+    // A sleeping particle wakes up if it touches any neighbor during the sweep, awake or asleep, so that
+    // sleepers moving into each other collide as well. The contact test and the neighbor lists are
+    // symmetric, so both sides of every touching pair end up awake, and no thread reads a flag that
+    // another one writes.
+    for (int k = cu_neighbor_offset[i]; k < cu_neighbor_offset[i + 1]; k++) {
+        int j = cu_neighbor_index[k];
+        float t = contact_time(cu_position[i] - cu_position[j], cu_velocity[i] - cu_velocity[j],
+            cu_radius[i] + cu_radius[j], sweep_time);
+        if (t >= 0.0f) {
+            cu_asleep[i] = 0;
+            cu_sleep_counter[i] = 0;
+            return;
+        }
+    }
+}
+
+__global__ void count_contacts_kernel(const glm::vec3 *cu_position, const glm::vec3 *cu_velocity,
+    const float *cu_radius, const int *cu_neighbor_offset, const int *cu_neighbor_index, const int *cu_asleep,
+    int *cu_contact_count, int *cu_contact_seen, const int num_particles, const float sweep_time) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= num_particles) {
+        return;
+    }
+    // After wake_touched_kernel both sides of every touching pair are awake, so a sleeping particle has
+    // no contacts and every contact is emitted from both sides
+    if (cu_asleep[i]) {
+        cu_contact_count[i] = 0;
+        return;
+    }
+
+    int count = 0;
+    for (int k = cu_neighbor_offset[i]; k < cu_neighbor_offset[i + 1]; k++) {
+        int j = cu_neighbor_index[k];
+        float t = contact_time(cu_position[i] - cu_position[j], cu_velocity[i] - cu_velocity[j],
+            cu_radius[i] + cu_radius[j], sweep_time);
+        if (t >= 0.0f) {
+            count++;
+        }
+    }
+    cu_contact_count[i] = count;
+    if (count > 0) {
+        cu_contact_seen[i] = 1;
+    }
+}
+
+__global__ void fill_contacts_kernel(const glm::vec3 *cu_position, const glm::vec3 *cu_velocity,
+    const float *cu_radius, const int *cu_neighbor_offset, const int *cu_neighbor_index, const int *cu_asleep,
+    const int *cu_contact_offset, int *cu_contact_index, float *cu_contact_time, const int num_particles,
+    const float sweep_time) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= num_particles || cu_asleep[i]) {
+        return;
+    }
+
+    int c = cu_contact_offset[i];
+    for (int k = cu_neighbor_offset[i]; k < cu_neighbor_offset[i + 1]; k++) {
+        int j = cu_neighbor_index[k];
+        float t = contact_time(cu_position[i] - cu_position[j], cu_velocity[i] - cu_velocity[j],
+            cu_radius[i] + cu_radius[j], sweep_time);
+        if (t >= 0.0f) {
+            cu_contact_index[c] = j;
+            cu_contact_time[c] = t;
+            c++;
+        }
+    }
+}
+
+__global__ void resolve_contacts_kernel(const glm::vec3 *cu_position, const glm::vec3 *cu_velocity,
+    const float *cu_mass, glm::vec3 *cu_velocity_next, float *cu_impact_time, float *cu_impulse,
+    const int *cu_contact_offset, const int *cu_contact_index, const float *cu_contact_time,
+    const float restitution, const int num_particles) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= num_particles) {
+        return;
+    }
+
+    // Every contact is seen from both sides and only reads the velocities of the previous step,
+    // so particle j receives exactly the opposite momentum and no thread writes another's state.
+    // The contact normal is taken at the time of impact, and the particle moves with its old
+    // velocity until the earliest of its impacts. Only approaching pairs exchange momentum, and the
+    // normal relative velocity is reversed and scaled by the coefficient of restitution.
+    glm::vec3 delta_velocity(0.0f);
+    float impact_time = 0.0f;
+    for (int c = cu_contact_offset[i]; c < cu_contact_offset[i + 1]; c++) {
+        int j = cu_contact_index[c];
+        float t = cu_contact_time[c];
+        glm::vec3 diff = (cu_position[i] + cu_velocity[i] * t) - (cu_position[j] + cu_velocity[j] * t);
+        float dist_sq = glm::dot(diff, diff);
+        float approach = glm::dot(cu_velocity[i] - cu_velocity[j], diff);
+        if (dist_sq > 0.0f && approach < 0.0f) {
+            float mass_ratio = (1.0f + restitution) * cu_mass[j] / (cu_mass[i] + cu_mass[j]);
+            delta_velocity -= mass_ratio * approach / dist_sq * diff;
+        }
+        impact_time = c == cu_contact_offset[i] ? t : fminf(impact_time, t);
+    }
+    cu_velocity_next[i] = cu_velocity[i] + delta_velocity;
+    cu_impact_time[i] = impact_time;
+    cu_impulse[i] += glm::length(delta_velocity);
+}
+
+__global__ void kick_kernel(glm::vec3 *cu_velocity, const glm::vec3 *cu_acceleration, const float delta_time,
+    const int num_particles) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= num_particles) {
+        return;
+    }
+
+    cu_velocity[i] += cu_acceleration[i] * delta_time;
+}
+
+__global__ void drift_kernel(glm::vec3 *cu_position, const glm::vec3 *cu_velocity_before,
+    const glm::vec3 *cu_velocity, const float *cu_impact_time, const float delta_time, const int num_particles) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= num_particles) {
+        return;
+    }
+
+    float impact_time = cu_impact_time[i];
+    cu_position[i] += cu_velocity_before[i] * impact_time + cu_velocity[i] * (delta_time - impact_time);
+}
+
+__global__ void update_activity_kernel(const glm::vec3 *cu_velocity, const glm::vec3 *cu_acceleration,
+    const glm::vec3 *cu_previous_acceleration, const int *cu_neighbor_offset, const int *cu_neighbor_index,
+    const int *cu_contact_seen, int *cu_sleep_counter, int *cu_asleep, const float sleep_speed,
+    const float sleep_acceleration, const int sleep_steps, const int num_particles) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= num_particles) {
+        return;
+    }
+
+    // A particle is quiet if it had no contact, its gravity barely changed during the step, and it moves
+    // along with all of its neighbors
+    glm::vec3 change = cu_acceleration[i] - cu_previous_acceleration[i];
+    bool quiet = !cu_contact_seen[i] && glm::dot(change, change) <= sleep_acceleration * sleep_acceleration;
+    for (int k = cu_neighbor_offset[i]; k < cu_neighbor_offset[i + 1] && quiet; k++) {
+        glm::vec3 relative_velocity = cu_velocity[i] - cu_velocity[cu_neighbor_index[k]];
+        quiet = glm::dot(relative_velocity, relative_velocity) <= sleep_speed * sleep_speed;
+    }
+    cu_sleep_counter[i] = quiet ? cu_sleep_counter[i] + 1 : 0;
+    cu_asleep[i] = cu_sleep_counter[i] >= sleep_steps;
+}
+
+__global__ void select_merge_partner_kernel(const glm::vec3 *cu_velocity, const float *cu_mass,
+    const int *cu_contact_offset, const int *cu_contact_index, int *cu_merge_partner, const float accretion_speed,
+    const int num_particles) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= num_particles) {
+        return;
+    }
+
+    // The partner is the lowest-index contact that is slow enough to stick. Tombstones of removed
+    // particles have zero mass and never merge.
+    int partner = -1;
+    for (int c = cu_contact_offset[i]; c < cu_contact_offset[i + 1] && cu_mass[i] > 0.0f; c++) {
+        int j = cu_contact_index[c];
+        glm::vec3 relative_velocity = cu_velocity[i] - cu_velocity[j];
+        if (cu_mass[j] > 0.0f && glm::dot(relative_velocity, relative_velocity) < accretion_speed * accretion_speed
+            && (partner < 0 || j < partner)) {
+            partner = j;
+        }
+    }
+    cu_merge_partner[i] = partner;
+}
+
+__global__ void merge_pairs_kernel(glm::vec3 *cu_position, glm::vec3 *cu_velocity, float *cu_mass,
+    float *cu_radius, float *cu_impulse, const int *cu_merge_partner, int *cu_keep, const int num_particles) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= num_particles) {
+        return;
+    }
+
+    // Only pairs that chose each other merge, and the lower index absorbs the higher one.
+    // The absorbed particle only clears its own keep flag, so no state is written twice.
+    int j = cu_merge_partner[i];
+    if (j < 0 || cu_merge_partner[j] != i) {
+        cu_keep[i] = 1;
+        return;
+    }
+    if (j < i) {
+        cu_keep[i] = 0;
+        return;
+    }
+
+    float mass = cu_mass[i] + cu_mass[j];
+    cu_position[i] = (cu_mass[i] * cu_position[i] + cu_mass[j] * cu_position[j]) / mass;
+    cu_velocity[i] = (cu_mass[i] * cu_velocity[i] + cu_mass[j] * cu_velocity[j]) / mass;
+    cu_radius[i] = cbrtf(cu_radius[i] * cu_radius[i] * cu_radius[i] + cu_radius[j] * cu_radius[j] * cu_radius[j]);
+    cu_impulse[i] += cu_impulse[j];
+    cu_mass[i] = mass;
+    cu_keep[i] = 1;
+}
+
+__global__ void pairwise_sum_kernel(glm::vec3 *cu_value, const int num_values, const int half) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= num_values - half) {
+        return;
+    }
+
+    cu_value[i] += cu_value[i + half];
+}
+
+__global__ void pairwise_sum_kernel(float *cu_value, const int num_values, const int half) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= num_values - half) {
+        return;
+    }
+
+    cu_value[i] += cu_value[i + half];
+}
+
+__global__ void flag_alive_kernel(const float *cu_mass, int *cu_keep, const int num_particles) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= num_particles) {
+        return;
+    }
+
+    cu_keep[i] = cu_mass[i] > 0.0f;
+}
+
+__global__ void mass_moment_kernel(const glm::vec3 *cu_position, const glm::vec3 *cu_velocity,
+    const float *cu_mass, glm::vec3 *cu_position_moment, glm::vec3 *cu_velocity_moment, const int num_particles) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= num_particles) {
+        return;
+    }
+
+    cu_position_moment[i] = cu_mass[i] * cu_position[i];
+    cu_velocity_moment[i] = cu_mass[i] * cu_velocity[i];
+}
+
+__global__ void flag_escaped_kernel(const glm::vec3 *cu_position, const glm::vec3 *cu_velocity,
+    const float *cu_mass, const glm::vec3 center, const glm::vec3 center_velocity, const float total_mass,
+    const float escape_distance, int *cu_keep, const int num_particles) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= num_particles) {
+        return;
+    }
+    // Tombstones stay in place until remove_tombstones, so they never turn into retired particles
+    if (cu_mass[i] <= 0.0f) {
+        cu_keep[i] = 1;
+        return;
+    }
+
+    // A particle has escaped if it is far from the center of mass, moves away from it and is not bound
+    // to the total mass treated as a point
+    glm::vec3 distance_vec = cu_position[i] - center;
+    glm::vec3 relative_velocity = cu_velocity[i] - center_velocity;
+    float distance = glm::length(distance_vec);
+    float energy = 0.5f * glm::dot(relative_velocity, relative_velocity)
+        - GRAVITATIONAL_CONSTANT * total_mass / fmaxf(distance, 1e-6f);
+    bool escaped = distance > escape_distance && glm::dot(distance_vec, relative_velocity) > 0.0f && energy > 0.0f;
+    cu_keep[i] = !escaped;
+}
+
+__global__ void compact_kernel(const int *cu_keep, const int *cu_new_index, const glm::vec3 *cu_source,
+    glm::vec3 *cu_destination, const int num_particles) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= num_particles || !cu_keep[i]) {
+        return;
+    }
+
+    cu_destination[cu_new_index[i]] = cu_source[i];
+}
+
+__global__ void compact_kernel(const int *cu_keep, const int *cu_new_index, const float *cu_source,
+    float *cu_destination, const int num_particles) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= num_particles || !cu_keep[i]) {
+        return;
+    }
+
+    cu_destination[cu_new_index[i]] = cu_source[i];
+}
+
+__global__ void compact_kernel(const int *cu_keep, const int *cu_new_index, const int *cu_source,
+    int *cu_destination, const int num_particles) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= num_particles || !cu_keep[i]) {
+        return;
+    }
+
+    cu_destination[cu_new_index[i]] = cu_source[i];
+}
+
+__global__ void source_index_kernel(const int *cu_keep, const int *cu_new_index, int *cu_source_index,
+    const int num_particles) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= num_particles || !cu_keep[i]) {
+        return;
+    }
+
+    cu_source_index[cu_new_index[i]] = i;
+}
+
+__global__ void count_neighbors_kernel(const glm::vec3 *cu_position, const float *cu_mass, const float *cu_radius,
+    int *cu_neighbor_count, const int num_particles, const float skin) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= num_particles) {
+        return;
+    }
+
+    // Tombstones have no neighbors and are nobody's neighbor, so the contact, wake and activity passes
+    // never pair a live particle with a slot of zero mass
+    int count = 0;
+    for (int j = 0; j < num_particles && cu_mass[i] > 0.0f; j++) {
+        if (i == j || cu_mass[j] <= 0.0f) {
+            continue;
+        }
+        glm::vec3 diff = cu_position[j] - cu_position[i];
+        float neighbor_distance = cu_radius[i] + cu_radius[j] + skin;
+        if (glm::dot(diff, diff) <= neighbor_distance * neighbor_distance) {
+            count++;
+        }
+    }
+    cu_neighbor_count[i] = count;
+}
+
+__global__ void fill_neighbors_kernel(const glm::vec3 *cu_position, const float *cu_mass, const float *cu_radius,
+    const int *cu_neighbor_offset, int *cu_neighbor_index, const int num_particles, const float skin) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= num_particles) {
+        return;
+    }
+
+    // Same test as count_neighbors_kernel, so exactly cu_neighbor_count[i] entries are written
+    int k = cu_neighbor_offset[i];
+    for (int j = 0; j < num_particles && cu_mass[i] > 0.0f; j++) {
+        if (i == j || cu_mass[j] <= 0.0f) {
+            continue;
+        }
+        glm::vec3 diff = cu_position[j] - cu_position[i];
+        float neighbor_distance = cu_radius[i] + cu_radius[j] + skin;
+        if (glm::dot(diff, diff) <= neighbor_distance * neighbor_distance) {
+            cu_neighbor_index[k++] = j;
+        }
+    }
+}
+
+__global__ void compute_displacement_kernel(const glm::vec3 *cu_position,
+    const glm::vec3 *cu_reference_position, const glm::vec3 *cu_velocity, float *cu_displacement,
+    const float lookahead_time, const int num_particles) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= num_particles) {
+        return;
+    }
+
+    // Squared distance the particle may be away from its reference position by the end of the lookahead
+    float displacement = glm::distance(cu_position[i], cu_reference_position[i])
+        + glm::length(cu_velocity[i]) * lookahead_time;
+    cu_displacement[i] = displacement * displacement;
 }
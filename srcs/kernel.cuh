@@ -5,7 +5,63 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
-__global__ void update_particle_kernel(glm::vec3 *cu_position, glm::vec3 *cu_velocity, const float mass,
-    const float delta_time, const int num_particles, const float collision_distance);
+#include "SimulationConfig.hpp"
+
+__global__ void compute_gravity_kernel(const glm::vec3 *cu_position, const float *cu_mass, const float *cu_radius,
+    glm::vec3 *cu_acceleration, const int *cu_asleep, const bool include_asleep, const int num_particles);
+
+__global__ void wake_touched_kernel(const glm::vec3 *cu_position, const glm::vec3 *cu_velocity,
+    const float *cu_radius, const int *cu_neighbor_offset, const int *cu_neighbor_index, int *cu_asleep,
+    int *cu_sleep_counter, const int num_particles, const float sweep_time);
+__global__ void count_contacts_kernel(const glm::vec3 *cu_position, const glm::vec3 *cu_velocity,
+    const float *cu_radius, const int *cu_neighbor_offset, const int *cu_neighbor_index, const int *cu_asleep,
+    int *cu_contact_count, int *cu_contact_seen, const int num_particles, const float sweep_time);
+__global__ void fill_contacts_kernel(const glm::vec3 *cu_position, const glm::vec3 *cu_velocity,
+    const float *cu_radius, const int *cu_neighbor_offset, const int *cu_neighbor_index, const int *cu_asleep,
+    const int *cu_contact_offset, int *cu_contact_index, float *cu_contact_time, const int num_particles,
+    const float sweep_time);
+__global__ void resolve_contacts_kernel(const glm::vec3 *cu_position, const glm::vec3 *cu_velocity,
+    const float *cu_mass, glm::vec3 *cu_velocity_next, float *cu_impact_time, float *cu_impulse,
+    const int *cu_contact_offset, const int *cu_contact_index, const float *cu_contact_time,
+    const float restitution, const int num_particles);
+__global__ void kick_kernel(glm::vec3 *cu_velocity, const glm::vec3 *cu_acceleration, const float delta_time,
+    const int num_particles);
+__global__ void drift_kernel(glm::vec3 *cu_position, const glm::vec3 *cu_velocity_before,
+    const glm::vec3 *cu_velocity, const float *cu_impact_time, const float delta_time, const int num_particles);
+
+__global__ void update_activity_kernel(const glm::vec3 *cu_velocity, const glm::vec3 *cu_acceleration,
+    const glm::vec3 *cu_previous_acceleration, const int *cu_neighbor_offset, const int *cu_neighbor_index,
+    const int *cu_contact_seen, int *cu_sleep_counter, int *cu_asleep, const float sleep_speed,
+    const float sleep_acceleration, const int sleep_steps, const int num_particles);
+
+__global__ void select_merge_partner_kernel(const glm::vec3 *cu_velocity, const float *cu_mass,
+    const int *cu_contact_offset, const int *cu_contact_index, int *cu_merge_partner, const float accretion_speed,
+    const int num_particles);
+__global__ void merge_pairs_kernel(glm::vec3 *cu_position, glm::vec3 *cu_velocity, float *cu_mass,
+    float *cu_radius, float *cu_impulse, const int *cu_merge_partner, int *cu_keep, const int num_particles);
+__global__ void pairwise_sum_kernel(glm::vec3 *cu_value, const int num_values, const int half);
+__global__ void pairwise_sum_kernel(float *cu_value, const int num_values, const int half);
+__global__ void flag_alive_kernel(const float *cu_mass, int *cu_keep, const int num_particles);
+__global__ void mass_moment_kernel(const glm::vec3 *cu_position, const glm::vec3 *cu_velocity,
+    const float *cu_mass, glm::vec3 *cu_position_moment, glm::vec3 *cu_velocity_moment, const int num_particles);
+__global__ void flag_escaped_kernel(const glm::vec3 *cu_position, const glm::vec3 *cu_velocity,
+    const float *cu_mass, const glm::vec3 center, const glm::vec3 center_velocity, const float total_mass,
+    const float escape_distance, int *cu_keep, const int num_particles);
+__global__ void compact_kernel(const int *cu_keep, const int *cu_new_index, const glm::vec3 *cu_source,
+    glm::vec3 *cu_destination, const int num_particles);
+__global__ void compact_kernel(const int *cu_keep, const int *cu_new_index, const float *cu_source,
+    float *cu_destination, const int num_particles);
+__global__ void compact_kernel(const int *cu_keep, const int *cu_new_index, const int *cu_source,
+    int *cu_destination, const int num_particles);
+__global__ void source_index_kernel(const int *cu_keep, const int *cu_new_index, int *cu_source_index,
+    const int num_particles);
+
+__global__ void count_neighbors_kernel(const glm::vec3 *cu_position, const float *cu_mass, const float *cu_radius,
+    int *cu_neighbor_count, const int num_particles, const float skin);
+__global__ void fill_neighbors_kernel(const glm::vec3 *cu_position, const float *cu_mass, const float *cu_radius,
+    const int *cu_neighbor_offset, int *cu_neighbor_index, const int num_particles, const float skin);
+__global__ void compute_displacement_kernel(const glm::vec3 *cu_position,
+    const glm::vec3 *cu_reference_position, const glm::vec3 *cu_velocity, float *cu_displacement,
+    const float lookahead_time, const int num_particles);
 
 #endif
@@ -2,17 +2,19 @@
 #include <GLFW/glfw3.h>
 
 #include <cmath>
+#include <filesystem>
 #include <iostream>
+#include <string>
 #include <vector>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include "CameraBuffer.hpp"
 #include "Particle.hpp"
+#include "ParticleRenderer.hpp"
 #include "Shader.hpp"
-
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
+#include "TextureLoader.hpp"
 
 
 glm::vec3 camera_pos = glm::vec3(0.0f, 2.0f, 10.0f);
@@ -27,8 +29,14 @@ float last_X = 400, last_Y = 300;
 bool first_mouse = true;
 float fov = 45.0f;
 
+// Framebuffer size reported by the last resize, applied at the start of the next frame
+int framebuffer_w = 0, framebuffer_h = 0;
+bool framebuffer_resized = false;
+
 const int LAT_SEGMENTS = 10;
 const int LON_SEGMENTS = 20;
+const int LOW_POLY_LAT_SEGMENTS = 4;
+const int LOW_POLY_LON_SEGMENTS = 8;
 const float PI = 3.14159265359f;
 
 void process_input(GLFWwindow* window) {
@@ -60,7 +68,7 @@ void process_input(GLFWwindow* window) {
     }
 }
 
-void mouse_callback(GLFWwindow *window, double xpos, double ypos) {
+void mouse_callback(GLFWwindow *, double xpos, double ypos) {
     if (first_mouse) {
         last_X = xpos;
         last_Y = ypos;
@@ -92,7 +100,7 @@ void mouse_callback(GLFWwindow *window, double xpos, double ypos) {
     camera_front = glm::normalize(direction);
 }
 
-void scroll_callback(GLFWwindow *window, double xoffset, double yoffset) {
+void scroll_callback(GLFWwindow *, double, double yoffset) {
     fov -= (float)yoffset;
     if (fov < 1.0f) {
         fov = 1.0f;
@@ -102,82 +110,23 @@ void scroll_callback(GLFWwindow *window, double xoffset, double yoffset) {
     }
 }
 
-unsigned int load_texture(char const * path, bool repeat) {
-    unsigned int texture_ID;
-    glGenTextures(1, &texture_ID);
-
-    int width, height, nr_components;
-    unsigned char *data = stbi_load(path, &width, &height, &nr_components, 0);
-    if (data) {
-        GLenum format;
-        if (nr_components == 1) {
-            format = GL_RED;
-        } else if (nr_components == 3) {
-            format = GL_RGB;
-        } else if (nr_components == 4) {
-            format = GL_RGBA;
-        }
-
-        glBindTexture(GL_TEXTURE_2D, texture_ID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        if (repeat) {
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        } else {
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        }
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    } else {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
-    }
-
-    return texture_ID;
+void framebuffer_size_callback(GLFWwindow *, int width, int height) {
+    framebuffer_w = width;
+    framebuffer_h = height;
+    framebuffer_resized = true;
 }
 
-unsigned int load_cubemap(std::vector<std::string> faces) {
-    unsigned int texture_ID;
-    glGenTextures(1, &texture_ID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, texture_ID);
-
-    int width, height, nr_channels;
-    for (unsigned int i = 0; i < faces.size(); i++) {
-        unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nr_channels, 0);
-        if (data) {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-            stbi_image_free(data);
-        } else {
-            std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
-            stbi_image_free(data);
-        }
-    }
-
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-
-    return texture_ID;
-}
-
-std::vector<float> generate_particle_vertices(float radius) {
+std::vector<float> generate_particle_vertices(float radius, int lat_segments, int lon_segments) {
     std::vector<float> vertices;
 
-    for (int lat = 0; lat <= LAT_SEGMENTS; ++lat) {
-        int fix_lat = lat - int(LAT_SEGMENTS / 2);
-        float phi = fix_lat * PI / LAT_SEGMENTS;
+    for (int lat = 0; lat <= lat_segments; ++lat) {
+        int fix_lat = lat - int(lat_segments / 2);
+        float phi = fix_lat * PI / lat_segments;
         float sin_phi = sin(phi);
         float cos_phi = cos(phi);
 
-        for (int lon = 0; lon <= LON_SEGMENTS; ++lon) {
-            float theta = lon * 2 * PI / LON_SEGMENTS;
+        for (int lon = 0; lon <= lon_segments; ++lon) {
+            float theta = lon * 2 * PI / lon_segments;
             float sin_theta = sin(theta);
             float cos_theta = cos(theta);
 
@@ -193,7 +142,30 @@ std::vector<float> generate_particle_vertices(float radius) {
     return vertices;
 }
 
+std::filesystem::path cache_directory(const char *argv0) {
+    // The caches live in cache/ next to srcs/, one level above the executable, so that they don't depend
+    // on the working directory. /proc/self/exe also resolves an executable that was found through PATH.
+    std::error_code error;
+    std::filesystem::path executable = std::filesystem::read_symlink("/proc/self/exe", error);
+    if (error) {
+        executable = std::filesystem::absolute(argv0);
+    }
+    return executable.parent_path().parent_path() / "cache";
+}
+
 int main(int argc, char *argv[]) {
+    // The default is the elastic baseline with gravity and elastic collisions only. --impact-physics
+    // switches on inelastic collisions, accretion and escapes together with the acceleration structures.
+    bool impact_physics = false;
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--impact-physics") {
+            impact_physics = true;
+        } else {
+            std::cout << "Usage: " << argv[0] << " [--impact-physics]" << std::endl;
+            return -1;
+        }
+    }
+
     // Initialize window
     if (!glfwInit()) {
         std::cout << "Error: Failed to initialize GLFW" << std::endl;
@@ -216,14 +188,16 @@ int main(int argc, char *argv[]) {
     glfwMakeContextCurrent(window);
     glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetScrollCallback(window, scroll_callback);
+    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
         std::cout << "Error: Failed to initialize GLAD" << std::endl;
         glfwTerminate();
         return -1;
     }
+    std::filesystem::path cache_dir = cache_directory(argv[0]);
+    Shader::enableBinaryCache((GLADloadproc)glfwGetProcAddress, (cache_dir / "shaders").string());
 
-    Shader particle_shader("../shaders/particle.vs", "../shaders/particle.fs");
     Shader space_box_shader("../shaders/space_box.vs", "../shaders/space_box.fs");
 
     float space_box_vertices[] = {
@@ -272,61 +246,47 @@ int main(int argc, char *argv[]) {
     };
 
     float particle_radius = 0.02f;
-    std::vector<float> particle_vertices = generate_particle_vertices(particle_radius);
+    std::vector<float> particle_vertices = generate_particle_vertices(1.0f, LAT_SEGMENTS, LON_SEGMENTS);
+    std::vector<float> low_poly_vertices = generate_particle_vertices(1.0f, LOW_POLY_LAT_SEGMENTS,
+        LOW_POLY_LON_SEGMENTS);
     glm::vec3 center_pos_1(0.0f);
     glm::vec3 center_pos_2(3.0f, 3.0f, 3.7f);
     float planet_radius = 0.7f;
     int particle_num_1 = 50000;
     int particle_num_2 = 50000;
-    int particle_num = particle_num_1 + particle_num_2;
     glm::vec3 initial_velocity_1 = glm::vec3(0.25f);
     glm::vec3 initial_velocity_2 = glm::vec3(-0.25f);
     float mass = 1.0f;
     int threads = 256;
+    SimulationConfig config;
+    config.neighbor_skin = particle_radius;
+    config.packing_cache_dir = cache_dir.string();
+    if (impact_physics) {
+        config.continuous_collision = true;
+        config.respa_inner_steps = 4;
+        config.restitution = 0.8f;
+        config.accretion_speed = 0.01f;
+        // The packed planets have no touching pairs, while the first steps of the impact reach about 2
+        // to 3 per particle, so the event-driven solver only takes over while the planets collide
+        config.event_driven_contact_ratio = 1.5f;
+        config.coarsening_interval = 100;
+        // Unit masses attract each other far too weakly to bind a clump, so settled clumps are only
+        // judged by their velocity dispersion and contact impulses
+        config.coarsening_require_bound = false;
+        config.sleep_steps = 20;
+        config.escape_check_interval = 50;
+        config.initial_packing = InitialPacking::HCP;
+    }
     Particle particles(center_pos_1, center_pos_2, planet_radius, particle_num_1,
-        particle_num_2, initial_velocity_1, initial_velocity_2, mass, particle_radius, threads);
+        particle_num_2, initial_velocity_1, initial_velocity_2, mass, particle_radius, threads, config);
 
-    // Initialize window
+    // Initialize window. The framebuffer can be larger than the window on high-DPI screens.
+    glfwGetFramebufferSize(window, &window_w, &window_h);
     glViewport(0, 0, window_w, window_h);
 
-    // particle VAO
-    unsigned int particle_VAO, particle_VBO;
-    glGenVertexArrays(1, &particle_VAO);
-    glGenBuffers(1, &particle_VBO);
-
-    // Store instance data in an array buffer
-    unsigned int instance_VBO;
-    glGenBuffers(1, &instance_VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, instance_VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * particle_num, particles.get_particle_position().data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-    unsigned int instance_color_VBO;
-    glGenBuffers(1, &instance_color_VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, instance_color_VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * particle_num, particles.get_particle_color().data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-    glBindVertexArray(particle_VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, particle_VBO);
-    glBufferData(GL_ARRAY_BUFFER, particle_vertices.size() * sizeof(float), particle_vertices.data(), GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-
-    // Particle instance data
-    glEnableVertexAttribArray(1);
-    glBindBuffer(GL_ARRAY_BUFFER, instance_VBO);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glVertexAttribDivisor(1, 1); // Tell OpenGL this is per-instance data
-
-    // set instance data(color)
-    glEnableVertexAttribArray(2);
-    glBindBuffer(GL_ARRAY_BUFFER, instance_color_VBO);
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glVertexAttribDivisor(2, 1); // tell OpenGL this is an instanced vertex attribute
-    glBindVertexArray(0);
+    ParticleRenderer particle_renderer(particle_vertices, low_poly_vertices, window_w, window_h);
+    int projectile_palette = particles.add_palette(glm::vec3(1.0f), glm::vec3(1.0f), glm::vec3(1.0f));
+    particle_renderer.set_palette(particles.get_palette_stops());
 
     // Space box VAO
     unsigned int skybox_VAO, skybox_VBO;
@@ -341,8 +301,6 @@ int main(int argc, char *argv[]) {
 
     glEnable(GL_DEPTH_TEST);
 
-    unsigned int cubeTexture = load_texture("../textures/awesomeface.png", true);
-
     std::vector<std::string> faces
     {
         "../textures/space_box/right.png",
@@ -352,49 +310,93 @@ int main(int argc, char *argv[]) {
         "../textures/space_box/front.png",
         "../textures/space_box/back.png"
     };
-    unsigned int cubemap_texture = load_cubemap(faces);
+    TextureLoader texture_loader;
+    unsigned int cubemap_texture = texture_loader.load_cubemap(faces);
 
     double last_time = glfwGetTime();
     double fps_last_time = glfwGetTime();
     int frame_num = 0;
+    bool spawn_held = false;
+    bool mesh_held = false;
+    bool lod_held = false;
+    bool culling_held = false;
+    bool occlusion_held = false;
+    bool quantized_held = false;
+    bool splatting_held = false;
     space_box_shader.use();
     space_box_shader.setInt("spacebox", 0);
+    space_box_shader.bindUniformBlock("Camera", CAMERA_BINDING);
+    CameraBuffer camera_buffer;
     while (!glfwWindowShouldClose(window)) {
         process_input(window);
+        // A minimized window has an empty framebuffer; keep the old size until it is restored
+        if (framebuffer_resized && framebuffer_w > 0 && framebuffer_h > 0) {
+            window_w = framebuffer_w;
+            window_h = framebuffer_h;
+            glViewport(0, 0, window_w, window_h);
+            particle_renderer.set_viewport(window_w, window_h);
+            framebuffer_resized = false;
+        }
         glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         double current_time = glfwGetTime();
-        double delta = current_time - last_time;
+        double delta = config.deterministic ? config.fixed_delta_time : current_time - last_time;
         particles.update_particle(delta);
         last_time = glfwGetTime();
 
-        glBindBuffer(GL_ARRAY_BUFFER, instance_VBO);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * particle_num, particles.get_particle_position().data(), GL_STATIC_DRAW);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        glBindBuffer(GL_ARRAY_BUFFER, instance_color_VBO);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * particle_num, particles.get_particle_color().data(), GL_STATIC_DRAW);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        // Fire a projectile from the camera, once per key press
+        bool spawn_pressed = glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS;
+        if (spawn_pressed && !spawn_held) {
+            particles.add_particle(camera_pos, 2.0f * camera_front, 10.0f * mass, 2.0f * particle_radius,
+                glm::u8vec2(projectile_palette, 0));
+        }
+        spawn_held = spawn_pressed;
+
+        // Switch between sphere impostors and the sphere mesh for all particles, or level of detail
+        bool lod_pressed = glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS;
+        if (lod_pressed && !lod_held) {
+            particle_renderer.set_lod(!particle_renderer.get_lod());
+        }
+        lod_held = lod_pressed;
+        bool culling_pressed = glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS;
+        if (culling_pressed && !culling_held) {
+            particle_renderer.set_culling(!particle_renderer.get_culling());
+        }
+        culling_held = culling_pressed;
+        bool occlusion_pressed = glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS;
+        if (occlusion_pressed && !occlusion_held) {
+            particle_renderer.set_occlusion(!particle_renderer.get_occlusion());
+        }
+        occlusion_held = occlusion_pressed;
+        bool quantized_pressed = glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS;
+        if (quantized_pressed && !quantized_held) {
+            particle_renderer.set_quantized(!particle_renderer.get_quantized());
+        }
+        quantized_held = quantized_pressed;
+        bool splatting_pressed = glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS;
+        if (splatting_pressed && !splatting_held) {
+            particle_renderer.set_splatting(!particle_renderer.get_splatting());
+        }
+        splatting_held = splatting_pressed;
+        bool mesh_pressed = glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS;
+        if (mesh_pressed && !mesh_held) {
+            particle_renderer.set_impostors(!particle_renderer.get_impostors());
+        }
+        mesh_held = mesh_pressed;
+
+        particle_renderer.upload(particles.get_particle_position(), particles.get_particle_shade(),
+            particles.get_particle_radius());
 
         // particle
-        particle_shader.use();
         glm::mat4 view = glm::lookAt(camera_pos, camera_pos + camera_front, camera_up);
         glm::mat4 projection = glm::perspective(glm::radians(fov), float(window_w) / float(window_h), 0.1f, 100.0f);
-        glBindVertexArray(particle_VAO);
-        unsigned int particle_view = glGetUniformLocation(particle_shader.ID, "view");
-        unsigned int particle_proj = glGetUniformLocation(particle_shader.ID, "projection");
-        glUniformMatrix4fv(particle_view, 1, GL_FALSE, &view[0][0]);
-        glUniformMatrix4fv(particle_proj, 1, GL_FALSE, &projection[0][0]);
-        glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, particle_vertices.size() / 3, particle_num);
+        camera_buffer.update(view, projection, window_w, window_h);
+        particle_renderer.draw(view, projection);
 
         // Draw skybox as last
         glDepthFunc(GL_LEQUAL);
         space_box_shader.use();
-        view = glm::mat3(glm::lookAt(camera_pos, camera_pos + camera_front, camera_up)); // Remove translation from the view matrix
-        unsigned int viewLoc = glGetUniformLocation(space_box_shader.ID, "view");
-        unsigned int projLoc = glGetUniformLocation(space_box_shader.ID, "projection");
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, &view[0][0]);
-        glUniformMatrix4fv(projLoc, 1, GL_FALSE, &projection[0][0]);
         // Skybox cube
         glBindVertexArray(skybox_VAO);
         glActiveTexture(GL_TEXTURE0);
@@ -2,15 +2,28 @@
 
 
 Octree::Octree(glm::vec3 min_3d_coord, glm::vec3 max_3d_coord) {
-    this->root.min_bound = min_3d_coord;
-    this->root.max_bound = max_3d_coord;
+    reset(min_3d_coord, max_3d_coord);
+}
+
+Octree::~Octree() {}
+
+void Octree::reset(const glm::vec3 &min_3d_coord, const glm::vec3 &max_3d_coord) {
+    // Empties the tree and fits the root to the given box, e.g. the bounding box of the particles
+    // reduced every step, so that no particle falls outside. The root is a cube so that all cells
+    // stay cubic, and is padded slightly so that points on the box faces are inside.
+    glm::vec3 center = 0.5f * (min_3d_coord + max_3d_coord);
+    glm::vec3 extent = max_3d_coord - min_3d_coord;
+    float half_size = 0.5f * std::max(extent.x, std::max(extent.y, extent.z));
+    half_size = half_size * 1.001f + 1e-6f;
+
+    this->root = Node();
+    this->root.min_bound = center - glm::vec3(half_size);
+    this->root.max_bound = center + glm::vec3(half_size);
     this->root.is_leaf = false;
     this->root.is_empty = false;
     subdivide(this->root);
 }
 
-Octree::~Octree() {}
-
 bool Octree::is_point_inside(Node &node, const glm::vec3 &position) {
     if (position.x < node.min_bound.x || position.x > node.max_bound.x ||
         position.y < node.min_bound.y || position.y > node.max_bound.y ||
@@ -4,6 +4,7 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
 #include <utility>
 #include <vector>
 #include <iostream>
@@ -31,6 +32,8 @@ class Octree {
         Octree(glm::vec3 min_3d_coord, glm::vec3 max_3d_coord);
         ~Octree();
 
+        void reset(const glm::vec3 &min_3d_coord, const glm::vec3 &max_3d_coord);
+
         bool is_point_inside(Node &node, const glm::vec3 &position);
         void insert(std::vector<glm::vec3> &position, std::vector<float> &mass);
         void insert_point(Node &node, const glm::vec3 &position, float mass);
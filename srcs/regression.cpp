@@ -0,0 +1,424 @@
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ParticleCoarsening.hpp"
+#include "ParticleCuda.cuh"
+#include "ParticleData.hpp"
+#include "SimulationConfig.hpp"
+
+// Golden-output regression harness. The same seeded scenario runs through every simulation backend,
+// and the positions and total energy of each result are compared against a double precision direct-sum
+// integration of the same scenario with REFERENCE_SUBSTEPS substeps per step. All backends evaluate
+// gravity with compute_gravity_kernel, so its forces are checked once against a double precision direct
+// sum on the final positions of the first backend.
+// Backends that only differ in the launch configuration must agree with another backend bit for bit.
+// Every backend also has to leave the tombstones of two removed, coincident particles inert, and a
+// settled clump has to be coarsened into one super-particle and split back into the same particles.
+// The exit status is non-zero if any backend exceeds its tolerances.
+//
+// Usage: ./regression [steps]
+
+
+struct Backend {
+    std::string name;
+    SimulationConfig config;
+    int threads;
+    double position_tolerance;  // 99th percentile of the distance to the reference positions
+    double energy_tolerance;    // Relative difference to the total energy of the reference
+    std::string identical_to;   // Backend whose final state must match bit for bit, if any
+};
+
+struct BackendResult {
+    ParticleData data;
+    std::vector<glm::vec3> acceleration;
+    double seconds;
+    int truncations;
+};
+
+struct ReferenceState {
+    std::vector<glm::dvec3> position;
+    std::vector<glm::dvec3> velocity;
+};
+
+const unsigned int SEED = 12345;
+const int PLANET_PARTICLES = 500;
+const float PLANET_RADIUS = 0.3f;
+const float PARTICLE_RADIUS = 0.01f;
+const float PARTICLE_MASS = 1e6f;
+const float DELTA_TIME = 0.005f;
+const int REFERENCE_SUBSTEPS = 10;
+const int TOMBSTONE_STEPS = 10;
+const double FORCE_TOLERANCE = 1e-4;  // 99th percentile of the relative force error
+
+void add_planet(ParticleData &data, std::mt19937 &gen, const glm::vec3 &center, const glm::vec3 &velocity) {
+    // Uniform density and no overlaps, so that all backends start from the same contact-free state
+    std::uniform_real_distribution<float> dis(-PLANET_RADIUS, PLANET_RADIUS);
+    int first = data.position.size();
+    while (data.position.size() - first < PLANET_PARTICLES) {
+        glm::vec3 offset(dis(gen), dis(gen), dis(gen));
+        if (glm::length(offset) > PLANET_RADIUS - PARTICLE_RADIUS) {
+            continue;
+        }
+        glm::vec3 pos = center + offset;
+        bool overlaps = false;
+        for (size_t i = first; i < data.position.size() && !overlaps; i++) {
+            overlaps = glm::distance(pos, data.position[i]) < 2.0f * PARTICLE_RADIUS;
+        }
+        if (overlaps) {
+            continue;
+        }
+        data.position.push_back(pos);
+        data.velocity.push_back(velocity);
+        data.mass.push_back(PARTICLE_MASS);
+        data.radius.push_back(PARTICLE_RADIUS);
+        data.shade.push_back(glm::u8vec2(0));
+        data.id.push_back(data.next_id++);
+    }
+}
+
+std::vector<glm::dvec3> to_double(const std::vector<glm::vec3> &values) {
+    return std::vector<glm::dvec3>(values.begin(), values.end());
+}
+
+void reference_acceleration(const std::vector<glm::dvec3> &position, const ParticleData &data,
+    std::vector<glm::dvec3> &acceleration) {
+    // Same pair rule as compute_gravity_kernel, summed in double precision
+    int n = position.size();
+    acceleration.assign(n, glm::dvec3(0.0));
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            if (i == j) {
+                continue;
+            }
+            glm::dvec3 distance_vec = position[j] - position[i];
+            double dist = glm::length(distance_vec);
+            if (dist > double(data.radius[i]) + double(data.radius[j])) {
+                acceleration[i] += distance_vec / dist * (double(GRAVITATIONAL_CONSTANT) * data.mass[j] / (dist * dist));
+            }
+        }
+    }
+}
+
+void resolve_reference_contacts(const std::vector<glm::dvec3> &position, std::vector<glm::dvec3> &velocity,
+    const ParticleData &data, const double restitution) {
+    // Same contact rule as resolve_contacts_kernel for touching pairs, from the velocities before the substep
+    int n = position.size();
+    std::vector<glm::dvec3> velocity_next(n);
+    for (int i = 0; i < n; i++) {
+        glm::dvec3 delta_velocity(0.0);
+        for (int j = 0; j < n; j++) {
+            glm::dvec3 diff = position[i] - position[j];
+            double dist_sq = glm::dot(diff, diff);
+            double collision_distance = double(data.radius[i]) + double(data.radius[j]);
+            if (i == j || dist_sq > collision_distance * collision_distance) {
+                continue;
+            }
+            double approach = glm::dot(velocity[i] - velocity[j], diff);
+            if (dist_sq > 0.0 && approach < 0.0) {
+                double mass_ratio = (1.0 + restitution) * data.mass[j] / (double(data.mass[i]) + data.mass[j]);
+                delta_velocity -= mass_ratio * approach / dist_sq * diff;
+            }
+        }
+        velocity_next[i] = velocity[i] + delta_velocity;
+    }
+    velocity.swap(velocity_next);
+}
+
+ReferenceState run_reference(const ParticleData &initial, const int steps, const double restitution) {
+    // Kick-drift-kick like the time-stepped backend, in double precision and with a step of
+    // DELTA_TIME / REFERENCE_SUBSTEPS, so that its own error is well below the tolerances
+    ReferenceState state;
+    state.position = to_double(initial.position);
+    state.velocity = to_double(initial.velocity);
+    int n = state.position.size();
+    double delta_time = double(DELTA_TIME) / REFERENCE_SUBSTEPS;
+    std::vector<glm::dvec3> acceleration;
+    reference_acceleration(state.position, initial, acceleration);
+    for (int step = 0; step < steps * REFERENCE_SUBSTEPS; step++) {
+        for (int i = 0; i < n; i++) {
+            state.velocity[i] += 0.5 * delta_time * acceleration[i];
+        }
+        resolve_reference_contacts(state.position, state.velocity, initial, restitution);
+        for (int i = 0; i < n; i++) {
+            state.position[i] += delta_time * state.velocity[i];
+        }
+        reference_acceleration(state.position, initial, acceleration);
+        for (int i = 0; i < n; i++) {
+            state.velocity[i] += 0.5 * delta_time * acceleration[i];
+        }
+    }
+    return state;
+}
+
+double total_energy(const std::vector<glm::dvec3> &position, const std::vector<glm::dvec3> &velocity,
+    const ParticleData &data) {
+    // Kinetic energy plus the pair potential, with overlapping pairs taken at contact distance
+    int n = position.size();
+    double energy = 0.0;
+    for (int i = 0; i < n; i++) {
+        energy += 0.5 * data.mass[i] * glm::dot(velocity[i], velocity[i]);
+        for (int j = i + 1; j < n; j++) {
+            double dist = glm::distance(position[i], position[j]);
+            dist = std::max(dist, double(data.radius[i]) + double(data.radius[j]));
+            energy -= double(GRAVITATIONAL_CONSTANT) * data.mass[i] * data.mass[j] / dist;
+        }
+    }
+    return energy;
+}
+
+bool is_identical(const ParticleData &a, const ParticleData &b) {
+    // Bitwise comparison, so that even differences in the sign of zero count
+    return a.position.size() == b.position.size()
+        && std::memcmp(a.position.data(), b.position.data(), a.position.size() * sizeof(glm::vec3)) == 0
+        && std::memcmp(a.velocity.data(), b.velocity.data(), a.velocity.size() * sizeof(glm::vec3)) == 0;
+}
+
+double percentile(std::vector<double> values, const double fraction) {
+    if (values.empty()) {
+        return 0.0;
+    }
+    int k = std::min(int(fraction * values.size()), int(values.size()) - 1);
+    std::nth_element(values.begin(), values.begin() + k, values.end());
+    return values[k];
+}
+
+BackendResult run_backend(const Backend &backend, const ParticleData &initial, const int steps) {
+    BackendResult result;
+    ParticleCuda particle_cuda;
+    particle_cuda.initialize(initial, backend.threads, backend.config);
+
+    std::vector<glm::vec3> position;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int step = 0; step < steps; step++) {
+        particle_cuda.update_position_velocity(position, DELTA_TIME);
+    }
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    result.seconds = std::chrono::duration<double>(end - start).count();
+
+    std::vector<float> impulse;
+    particle_cuda.download(result.data, impulse);
+    particle_cuda.download_acceleration(result.acceleration);
+    result.truncations = particle_cuda.get_event_driven_truncations();
+    result.data.id = initial.id;
+    result.data.shade = initial.shade;
+    return result;
+}
+
+bool is_finite(const glm::vec3 &value) {
+    return std::isfinite(value.x) && std::isfinite(value.y) && std::isfinite(value.z);
+}
+
+bool check_tombstones(const Backend &backend, const ParticleData &initial) {
+    // Particles 0 and 1 are moved on top of each other and removed the way Particle::remove_particle
+    // does it. Their zero-mass slots must neither move nor put NaNs into anybody's state.
+    ParticleData data = initial;
+    data.position[1] = data.position[0];
+    ParticleCuda particle_cuda;
+    particle_cuda.initialize(data, backend.threads, backend.config);
+    for (int i = 0; i < 2; i++) {
+        particle_cuda.write_particle(i, data.position[0], glm::vec3(0.0f), 0.0f, 0.0f);
+    }
+
+    std::vector<glm::vec3> position;
+    for (int step = 0; step < TOMBSTONE_STEPS; step++) {
+        particle_cuda.update_position_velocity(position, DELTA_TIME);
+    }
+    ParticleData result;
+    std::vector<float> impulse;
+    std::vector<glm::vec3> acceleration;
+    particle_cuda.download(result, impulse);
+    particle_cuda.download_acceleration(acceleration);
+    for (size_t i = 0; i < result.position.size(); i++) {
+        if (!is_finite(result.position[i]) || !is_finite(result.velocity[i]) || !is_finite(acceleration[i])) {
+            return false;
+        }
+    }
+    for (int i = 0; i < 2; i++) {
+        if (result.position[i] != data.position[0] || result.velocity[i] != glm::vec3(0.0f)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool check_coarsening() {
+    // A 3x3x3 clump of unit-mass particles like in the scene of main, drifting together with a small
+    // internal shear, lies in a single cell. Gravity between unit masses is far too weak to bind it,
+    // so it only counts as settled without the bound test.
+    SimulationConfig config;
+    config.coarsening_require_bound = false;
+    ParticleData data;
+    std::vector<float> impulse;
+    for (int x = 0; x < 3; x++) {
+        for (int y = 0; y < 3; y++) {
+            for (int z = 0; z < 3; z++) {
+                data.position.push_back(glm::vec3(0.02f) + 0.03f * glm::vec3(x, y, z));
+                data.velocity.push_back(glm::vec3(0.1f, 1e-3f * (x - 1), 0.0f));
+                data.mass.push_back(1.0f);
+                data.radius.push_back(0.01f);
+                data.shade.push_back(glm::u8vec2(0, 128));
+                data.id.push_back(data.next_id++);
+                impulse.push_back(0.0f);
+            }
+        }
+    }
+    ParticleData original = data;
+    ParticleCoarsening coarsening;
+    coarsening.initialize(config);
+    if (coarsening.coarsen(data, impulse) != int(original.position.size()) - 1 || data.position.size() != 1) {
+        return false;
+    }
+
+    // The super-particle drifts on, takes a strong contact impulse and comes apart into the original
+    // particles, shifted along with it and with their own velocities
+    glm::vec3 shift = DELTA_TIME * data.velocity[0];
+    data.position[0] += shift;
+    impulse[0] = 2.0f * config.coarsening_split_impulse;
+    if (coarsening.split(data, impulse) != 1 || data.position.size() != original.position.size()) {
+        return false;
+    }
+    for (size_t k = 0; k < data.position.size(); k++) {
+        size_t i = std::find(original.id.begin(), original.id.end(), data.id[k]) - original.id.begin();
+        if (i == original.id.size() || data.mass[k] != original.mass[i]
+            || glm::distance(data.position[k], original.position[i] + shift) > 1e-5f
+            || glm::distance(data.velocity[k], original.velocity[i]) > 1e-5f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::vector<Backend> make_backends() {
+    // Merging, escapes and coarsening change the particle set, so they stay off and particles can be
+    // compared by index. Collisions make the trajectories sensitive to the step size, so the positions
+    // are compared by a percentile rather than the largest difference. The tolerances are about 1.5
+    // times the errors of the default 100 steps.
+    SimulationConfig base;
+    base.deterministic = true;
+    base.seed = SEED;
+    base.neighbor_skin = PARTICLE_RADIUS;
+
+    std::vector<Backend> backends;
+    backends.push_back({"time_stepped", base, 256, 6.5e-2, 1.7e-2, ""});
+
+    // Results must not depend on the launch configuration at all
+    backends.push_back({"time_stepped_64_threads", base, 64, 6.5e-2, 1.7e-2, "time_stepped"});
+
+    SimulationConfig config = base;
+    config.continuous_collision = true;
+    backends.push_back({"continuous_collision", config, 256, 5e-2, 1e-2, ""});
+
+    config = base;
+    config.continuous_collision = true;
+    config.respa_inner_steps = 4;
+    backends.push_back({"respa_4", config, 256, 2.5e-2, 4e-3, ""});
+
+    config = base;
+    config.event_driven = true;
+    backends.push_back({"event_driven", config, 256, 3e-2, 2.1e-2, ""});
+
+    // Sleeping particles drift with forces as old as their last evaluation and are held to the same
+    // tolerances as the time-stepped backend
+    config = base;
+    config.sleep_steps = 5;
+    backends.push_back({"sleeping", config, 256, 6.5e-2, 1.7e-2, ""});
+    // Which particles sleep or wake up must not depend on thread scheduling either
+    backends.push_back({"sleeping_64_threads", config, 64, 6.5e-2, 1.7e-2, "sleeping"});
+    return backends;
+}
+
+int main(int argc, char **argv) {
+    int steps = argc > 1 ? std::atoi(argv[1]) : 100;
+
+    ParticleData initial;
+    std::mt19937 gen(SEED);
+    add_planet(initial, gen, glm::vec3(0.0f), glm::vec3(0.5f, 0.0f, 0.0f));
+    add_planet(initial, gen, glm::vec3(0.8f, 0.1f, 0.0f), glm::vec3(-0.5f, 0.0f, 0.0f));
+
+    std::vector<Backend> backends = make_backends();
+    ReferenceState reference_state = run_reference(initial, steps, backends[0].config.restitution);
+    double reference_energy = total_energy(reference_state.position, reference_state.velocity, initial);
+
+    std::vector<BackendResult> results;
+    for (const Backend &backend : backends) {
+        results.push_back(run_backend(backend, initial, steps));
+    }
+
+    std::printf("%-24s %10s %10s %10s %10s %9s %9s %10s  %s\n", "backend", "time[s]", "dpos p99", "dpos max",
+        "energy", "truncated", "identical", "tombstones", "result");
+    bool all_passed = true;
+    int fastest = -1;
+    for (size_t b = 0; b < backends.size(); b++) {
+        const Backend &backend = backends[b];
+        const BackendResult &result = results[b];
+
+        std::vector<glm::dvec3> position = to_double(result.data.position);
+        std::vector<double> position_error;
+        for (size_t i = 0; i < position.size(); i++) {
+            position_error.push_back(glm::distance(position[i], reference_state.position[i]));
+        }
+        double energy = total_energy(position, to_double(result.data.velocity), result.data);
+        double energy_error = std::abs(energy - reference_energy) / std::abs(reference_energy);
+
+        const char *identical = "-";
+        bool identical_passed = true;
+        for (size_t other = 0; other < b && !backend.identical_to.empty(); other++) {
+            if (backends[other].name == backend.identical_to) {
+                identical_passed = is_identical(result.data, results[other].data);
+                identical = identical_passed ? "yes" : "no";
+            }
+        }
+
+        bool tombstones_passed = check_tombstones(backend, initial);
+
+        double position_p99 = percentile(position_error, 0.99);
+        bool passed = position_p99 <= backend.position_tolerance && energy_error <= backend.energy_tolerance
+            && identical_passed && tombstones_passed;
+        all_passed = all_passed && passed;
+        if (passed && (fastest < 0 || result.seconds < results[fastest].seconds)) {
+            fastest = b;
+        }
+        std::printf("%-24s %10.4f %10.2e %10.2e %10.2e %9d %9s %10s  %s\n", backend.name.c_str(), result.seconds,
+            position_p99, percentile(position_error, 1.0), energy_error, result.truncations, identical,
+            tombstones_passed ? "inert" : "NaN/moved", passed ? "ok" : "FAILED");
+    }
+
+    // The acceleration of the first backend was evaluated on its final positions
+    std::vector<glm::dvec3> reference;
+    reference_acceleration(to_double(results[0].data.position), results[0].data, reference);
+    std::vector<double> force_error;
+    for (size_t i = 0; i < reference.size(); i++) {
+        double magnitude = glm::length(reference[i]);
+        if (magnitude > 0.0) {
+            force_error.push_back(glm::length(glm::dvec3(results[0].acceleration[i]) - reference[i]) / magnitude);
+        }
+    }
+    bool force_passed = percentile(force_error, 0.99) <= FORCE_TOLERANCE;
+    all_passed = all_passed && force_passed;
+    std::printf("Gravity kernel relative force error: p50 %.2e, p90 %.2e, p99 %.2e, max %.2e  %s\n",
+        percentile(force_error, 0.5), percentile(force_error, 0.9), percentile(force_error, 0.99),
+        percentile(force_error, 1.0), force_passed ? "ok" : "FAILED");
+
+    bool coarsening_passed = check_coarsening();
+    all_passed = all_passed && coarsening_passed;
+    std::cout << "Coarsening of a settled clump and splitting it again: " << (coarsening_passed ? "ok" : "FAILED")
+        << std::endl;
+
+    if (fastest >= 0) {
+        std::cout << "Fastest backend within tolerances: " << backends[fastest].name << std::endl;
+    }
+    if (!all_passed) {
+        std::cerr << "Regression check failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}